@@ -0,0 +1,236 @@
+#include "AllocProfiler.h"
+
+#ifdef VERSIONARY_ALLOC_PROFILE
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+const int STAGE_COUNT = static_cast<int>(AllocStage::Count);
+const char* const STAGE_NAMES[STAGE_COUNT] = {
+    "command", "decode", "hash", "merkle", "compare", "refine", "encode", "store"
+};
+
+// Counters are plain atomics so they are usable before main() and from any thread
+struct StageCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live{0};
+    std::atomic<int64_t> peak{0};
+    std::atomic<uint64_t> matAllocations{0};
+    std::atomic<uint64_t> matBytes{0};
+};
+
+StageCounters stages[STAGE_COUNT];
+std::atomic<int64_t> heapLive{0};
+std::atomic<int64_t> heapPeak{0};
+std::atomic<int64_t> matLive{0};
+std::atomic<int64_t> matPeak{0};
+
+thread_local int threadStage = -1;
+std::atomic<int> activeStage{0};
+std::atomic<int> activeScopes[STAGE_COUNT]; // Scopes of each stage open on any thread
+
+int currentStage() {
+    return threadStage >= 0 ? threadStage : activeStage.load(std::memory_order_relaxed);
+}
+
+void raisePeak(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Every block carries its size and stage in a header that keeps the payload 16-byte aligned
+struct alignas(16) BlockHeader {
+    size_t size;
+    int stage;
+};
+
+void* countedAllocate(size_t size) {
+    void* block = std::malloc(sizeof(BlockHeader) + size);
+    if (!block) return nullptr;
+
+    int stage = currentStage();
+    BlockHeader* header = static_cast<BlockHeader*>(block);
+    header->size = size;
+    header->stage = stage;
+
+    StageCounters& counters = stages[stage];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    raisePeak(counters.peak, counters.live.fetch_add(size, std::memory_order_relaxed) + static_cast<int64_t>(size));
+    raisePeak(heapPeak, heapLive.fetch_add(size, std::memory_order_relaxed) + static_cast<int64_t>(size));
+    return header + 1;
+}
+
+void countedFree(void* pointer) {
+    if (!pointer) return;
+    BlockHeader* header = static_cast<BlockHeader*>(pointer) - 1;
+    stages[header->stage].live.fetch_sub(header->size, std::memory_order_relaxed);
+    heapLive.fetch_sub(header->size, std::memory_order_relaxed);
+    std::free(header);
+}
+
+// Wraps OpenCV's standard allocator to count Mat buffers. The buffers themselves come from
+// cv::fastMalloc, not operator new, so they are counted here only.
+class CountingMatAllocator : public cv::MatAllocator {
+public:
+    explicit CountingMatAllocator(cv::MatAllocator* inner) : inner(inner) {}
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+        cv::UMatData* u = inner->allocate(dims, sizes, type, data, step, flags, usageFlags);
+        if (u) {
+            // Releases come back through us, so the matching deallocate is counted too
+            u->currAllocator = this;
+            if (!data) {
+                StageCounters& counters = stages[currentStage()];
+                counters.matAllocations.fetch_add(1, std::memory_order_relaxed);
+                counters.matBytes.fetch_add(u->size, std::memory_order_relaxed);
+                raisePeak(matPeak, matLive.fetch_add(u->size, std::memory_order_relaxed) + static_cast<int64_t>(u->size));
+            }
+        }
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override {
+        return inner->allocate(u, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if (!u) return;
+        if ((u->flags & cv::UMatData::USER_ALLOCATED) == 0) {
+            matLive.fetch_sub(u->size, std::memory_order_relaxed);
+        }
+        u->currAllocator = inner;
+        inner->deallocate(u);
+    }
+
+private:
+    cv::MatAllocator* inner;
+};
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    void* pointer = countedAllocate(size);
+    if (!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new[](std::size_t size) {
+    void* pointer = countedAllocate(size);
+    if (!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept { countedFree(pointer); }
+void operator delete[](void* pointer) noexcept { countedFree(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { countedFree(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { countedFree(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { countedFree(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { countedFree(pointer); }
+
+AllocProfiler::Scope::Scope(AllocStage stage)
+    : previousThreadStage(threadStage), previousActiveStage(activeStage.load(std::memory_order_relaxed)) {
+    threadStage = static_cast<int>(stage);
+    activeScopes[threadStage].fetch_add(1, std::memory_order_relaxed);
+    activeStage.store(threadStage, std::memory_order_relaxed);
+}
+
+// Scopes on different threads end in any order, so the shared stage is not simply restored:
+// once the last scope of a stage ends, the shared stage leaves it for the stage that was
+// active before, if that one is still open somewhere, and for Command otherwise
+AllocProfiler::Scope::~Scope() {
+    const int stage = threadStage;
+    threadStage = previousThreadStage;
+    if (activeScopes[stage].fetch_sub(1, std::memory_order_relaxed) == 1) {
+        int fallback = activeScopes[previousActiveStage].load(std::memory_order_relaxed) > 0
+                           ? previousActiveStage : static_cast<int>(AllocStage::Command);
+        int expected = stage;
+        activeStage.compare_exchange_strong(expected, fallback, std::memory_order_relaxed);
+    }
+}
+
+AllocProfiler::CommandScope::CommandScope(const std::string& command) : command(command) {
+    beginCommand();
+}
+
+AllocProfiler::CommandScope::~CommandScope() {
+    report(command);
+}
+
+void AllocProfiler::install() {
+    // Lives for the whole process, since Mats may be released during static destruction
+    static CountingMatAllocator allocator(cv::Mat::getStdAllocator());
+    cv::Mat::setDefaultAllocator(&allocator);
+}
+
+void AllocProfiler::beginCommand() {
+    for (StageCounters& counters : stages) {
+        counters.allocations = 0;
+        counters.bytes = 0;
+        counters.peak = counters.live.load();
+        counters.matAllocations = 0;
+        counters.matBytes = 0;
+    }
+    heapPeak = heapLive.load();
+    matPeak = matLive.load();
+    activeStage = static_cast<int>(AllocStage::Command);
+}
+
+void AllocProfiler::report(const std::string& command) {
+    // Read everything before printing, since the stream allocates too
+    uint64_t allocations[STAGE_COUNT], bytes[STAGE_COUNT], matAllocations[STAGE_COUNT], matBytes[STAGE_COUNT];
+    int64_t peaks[STAGE_COUNT];
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        allocations[i] = stages[i].allocations.load();
+        bytes[i] = stages[i].bytes.load();
+        peaks[i] = stages[i].peak.load();
+        matAllocations[i] = stages[i].matAllocations.load();
+        matBytes[i] = stages[i].matBytes.load();
+    }
+    int64_t heapPeakBytes = heapPeak.load();
+    int64_t matPeakBytes = matPeak.load();
+
+    std::cerr << "Allocations for \"" << command << "\":\n";
+    std::cerr << std::left << std::setw(10) << "stage" << std::right << std::setw(12) << "allocs"
+              << std::setw(16) << "bytes" << std::setw(16) << "peak live" << std::setw(12) << "Mat allocs"
+              << std::setw(16) << "Mat bytes" << "\n";
+    uint64_t totalAllocations = 0, totalBytes = 0, totalMatAllocations = 0, totalMatBytes = 0;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (allocations[i] == 0 && matAllocations[i] == 0) continue;
+        std::cerr << std::left << std::setw(10) << STAGE_NAMES[i] << std::right << std::setw(12) << allocations[i]
+                  << std::setw(16) << bytes[i] << std::setw(16) << peaks[i] << std::setw(12) << matAllocations[i]
+                  << std::setw(16) << matBytes[i] << "\n";
+        totalAllocations += allocations[i];
+        totalBytes += bytes[i];
+        totalMatAllocations += matAllocations[i];
+        totalMatBytes += matBytes[i];
+    }
+    std::cerr << std::left << std::setw(10) << "total" << std::right << std::setw(12) << totalAllocations
+              << std::setw(16) << totalBytes << std::setw(16) << heapPeakBytes << std::setw(12) << totalMatAllocations
+              << std::setw(16) << totalMatBytes << "\n";
+    std::cerr << "Peak live Mat buffers: " << matPeakBytes << " bytes\n";
+}
+
+#else
+
+void AllocProfiler::install() {}
+
+#endif // VERSIONARY_ALLOC_PROFILE
@@ -0,0 +1,60 @@
+#ifndef ALLOCPROFILER_H
+#define ALLOCPROFILER_H
+
+#include <string>
+
+// Pipeline stages that allocations are attributed to
+enum class AllocStage { Command, Decode, Hash, Merkle, Compare, Refine, Encode, Store, Count };
+
+// Allocation counts per stage and per command. Built with VERSIONARY_ALLOC_PROFILE defined,
+// the global operator new/delete and the default cv::MatAllocator are replaced by counting
+// versions and a table is printed after every command; otherwise every call is a no-op.
+//
+// The stage is per thread. Threads that never entered a stage (such as OpenCV's parallel_for_
+// workers) count towards the stage most recently entered on any thread while it is still
+// open there, and towards Command once no stage is.
+class AllocProfiler {
+public:
+    // Attributes allocations on this thread to `stage` until it goes out of scope
+    class Scope {
+    public:
+#ifdef VERSIONARY_ALLOC_PROFILE
+        explicit Scope(AllocStage stage);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        int previousThreadStage;
+        int previousActiveStage;
+#else
+        explicit Scope(AllocStage) {}
+#endif
+    };
+
+    // Gathers the figures of one command and prints them when it goes out of scope
+    class CommandScope {
+    public:
+#ifdef VERSIONARY_ALLOC_PROFILE
+        explicit CommandScope(const std::string& command);
+        ~CommandScope();
+
+    private:
+        std::string command;
+#else
+        explicit CommandScope(const std::string&) {}
+#endif
+    };
+
+    // Routes cv::Mat buffers through the counting allocator
+    static void install();
+
+private:
+    // Starts the figures of a new command; peaks restart from the memory still live
+    static void beginCommand();
+    // Prints the figures gathered since beginCommand
+    static void report(const std::string& command);
+};
+
+#endif // ALLOCPROFILER_H
@@ -0,0 +1,303 @@
+#include "BlameIndex.h"
+#include "Quadtree.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+// Loads the index; returns false if there is none, or it was built for another tile depth
+bool BlameIndex::load(const std::string& filename) {
+    std::ifstream infile(filename);
+    if (!infile.is_open()) {
+        return false;
+    }
+
+    layouts.clear();
+    tiles.clear();
+
+    std::string magic;
+    int formatVersion = 0, depth = 0;
+    if (!(infile >> magic >> formatVersion >> depth) || magic != "versionary-blame" ||
+        formatVersion != FORMAT_VERSION || depth != DEPTH) {
+        return false;
+    }
+
+    // "tile <key> <fingerprint> <count> <versions...>" and "version <v> <width> <height> <minSize>"
+    // as written by save, then the "change <v> <key> <fingerprint>" lines and the "version" line
+    // of every version appended since
+    std::string line;
+    while (std::getline(infile, line)) {
+        if (line.empty()) continue;
+        std::istringstream iss(line);
+        std::string kind;
+        iss >> kind;
+        if (kind == "version") {
+            int version;
+            Layout layout;
+            if (iss >> version >> layout.imageSize.width >> layout.imageSize.height >> layout.minSize) {
+                layouts[version] = layout;
+                continue;
+            }
+        } else if (kind == "change") {
+            int version;
+            uint32_t key;
+            uint64_t fingerprint;
+            if (iss >> version >> key >> std::hex >> fingerprint) {
+                History& history = tiles[key];
+                history.changes.push_back(version);
+                history.fingerprint = fingerprint;
+                continue;
+            }
+        } else if (kind == "tile") {
+            uint32_t key;
+            History history;
+            size_t count;
+            if (iss >> key >> std::hex >> history.fingerprint >> std::dec >> count) {
+                history.changes.resize(count);
+                bool complete = true;
+                for (size_t i = 0; i < count && complete; i++) {
+                    complete = static_cast<bool>(iss >> history.changes[i]);
+                }
+                if (complete) {
+                    tiles[key] = std::move(history);
+                    continue;
+                }
+            }
+        }
+        std::cerr << "Error parsing blame index line: " << line << std::endl;
+    }
+    return true;
+}
+
+void BlameIndex::save(const std::string& filename) const {
+    std::ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+
+    // Version lines go last, so the latest version is always on the file's last line
+    outfile << "versionary-blame " << FORMAT_VERSION << " " << DEPTH << "\n";
+    for (const auto& pair : tiles) {
+        outfile << "tile " << pair.first << " " << std::hex << pair.second.fingerprint << std::dec
+                << " " << pair.second.changes.size();
+        for (int version : pair.second.changes) {
+            outfile << " " << version;
+        }
+        outfile << "\n";
+    }
+    for (const auto& pair : layouts) {
+        outfile << "version " << pair.first << " " << pair.second.imageSize.width << " "
+                << pair.second.imageSize.height << " " << pair.second.minSize << "\n";
+    }
+}
+
+// Leaves and tiles are both in traversal order, so each tile's leaves follow one another
+std::vector<uint64_t> BlameIndex::tileFingerprints(const VersionHashes& record, std::vector<cv::Point>& cells) {
+    std::vector<cv::Rect> regions = Quadtree::nodeRegions(record.imageSize, record.minSize, DEPTH, &cells);
+
+    std::vector<uint64_t> fingerprints(regions.size());
+    size_t leaf = 0;
+    for (size_t t = 0; t < regions.size(); t++) {
+        uint64_t fingerprint = 0xcbf29ce484222325ULL;
+        while (leaf < record.regions.size() && (record.regions[leaf] & regions[t]) == record.regions[leaf]) {
+            fingerprint = (fingerprint ^ record.checksums[leaf]) * 0x100000001b3ULL;
+            leaf++;
+        }
+        fingerprints[t] = fingerprint;
+    }
+    return fingerprints;
+}
+
+// Records the version for tiles whose fingerprint moved. A new image size or leaf size
+// changes the layout, so every tile counts as changed.
+void BlameIndex::update(int version, const VersionHashes& record) {
+    if (!layouts.empty() && version <= latestVersion()) {
+        throw std::runtime_error("Blame index already covers version " + std::to_string(version) + ".");
+    }
+
+    Layout layout;
+    layout.imageSize = record.imageSize;
+    layout.minSize = record.minSize;
+    bool sameLayout = !layouts.empty() && layouts.rbegin()->second == layout;
+
+    std::vector<cv::Point> cells;
+    std::vector<uint64_t> fingerprints = tileFingerprints(record, cells);
+    for (size_t t = 0; t < fingerprints.size(); t++) {
+        History& history = tiles[cellKey(cells[t])];
+        if (!sameLayout || history.changes.empty() || history.fingerprint != fingerprints[t]) {
+            history.changes.push_back(version);
+        }
+        history.fingerprint = fingerprints[t];
+    }
+
+    layouts[version] = layout;
+}
+
+bool BlameIndex::readLatestVersion(const std::string& filename, int& version) {
+    std::ifstream infile(filename, std::ios::binary);
+    std::string magic;
+    int formatVersion = 0, depth = 0;
+    if (!(infile >> magic >> formatVersion >> depth) || magic != "versionary-blame" ||
+        formatVersion != FORMAT_VERSION || depth != DEPTH) {
+        return false;
+    }
+
+    // Both save and append end the file with the latest version's line; an index without
+    // versions ends with its header and is not usable
+    infile.clear();
+    infile.seekg(0, std::ios::end);
+    std::streamoff size = infile.tellg();
+    std::streamoff start = std::max<std::streamoff>(0, size - 256);
+    std::string tail(static_cast<size_t>(size - start), '\0');
+    infile.seekg(start);
+    if (!infile.read(&tail[0], static_cast<std::streamsize>(tail.size()))) {
+        return false;
+    }
+
+    size_t end = tail.find_last_not_of('\n');
+    if (end == std::string::npos) return false;
+    size_t lineStart = tail.find_last_of('\n', end);
+    std::istringstream iss(tail.substr(lineStart == std::string::npos ? 0 : lineStart + 1));
+    std::string kind;
+    return (iss >> kind >> version) && kind == "version";
+}
+
+// Only the latest version's fingerprints matter, and its hash record holds them
+bool BlameIndex::append(int version, const VersionHashes& record, const std::string& filename) {
+    int latest = 0;
+    if (!readLatestVersion(filename, latest)) {
+        return false;
+    }
+    if (version <= latest) {
+        throw std::runtime_error("Blame index already covers version " + std::to_string(version) + ".");
+    }
+
+    VersionHashes previous;
+    if (!HashStore::load(latest, previous)) {
+        std::remove(filename.c_str());
+        return false;
+    }
+    bool sameLayout = previous.imageSize == record.imageSize && previous.minSize == record.minSize;
+
+    std::vector<cv::Point> cells, previousCells;
+    std::vector<uint64_t> fingerprints = tileFingerprints(record, cells);
+    std::vector<uint64_t> previousFingerprints = tileFingerprints(previous, previousCells);
+
+    std::ofstream outfile(filename, std::ios::app);
+    if (!outfile.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+    for (size_t t = 0; t < fingerprints.size(); t++) {
+        if (!sameLayout || fingerprints[t] != previousFingerprints[t]) {
+            outfile << "change " << version << " " << cellKey(cells[t]) << " " << std::hex << fingerprints[t]
+                    << std::dec << "\n";
+        }
+    }
+    outfile << "version " << version << " " << record.imageSize.width << " " << record.imageSize.height << " "
+            << record.minSize << "\n";
+    return true;
+}
+
+// Whether the next version changed a tile is decided again against the previous version,
+// from their hash records: after deleting v2 of X, Y, X the tile is unchanged in v3. If the
+// latest version is removed, the previous version's fingerprints become the latest ones.
+void BlameIndex::remove(int version) {
+    auto it = layouts.find(version);
+    if (it == layouts.end()) return;
+
+    auto next = std::next(it);
+    const bool hasPrevious = it != layouts.begin();
+    const bool hasNext = next != layouts.end();
+    const bool sameLayout = hasPrevious && hasNext && std::prev(it)->second == next->second;
+
+    // Without the neighbours' records nothing can be decided; drop everything so the index
+    // is rebuilt on next use
+    std::map<uint32_t, uint64_t> before, after;
+    if ((!hasPrevious && !hasNext) || (hasPrevious && !loadFingerprints(std::prev(it)->first, before)) ||
+        (hasNext && !loadFingerprints(next->first, after))) {
+        layouts.clear();
+        tiles.clear();
+        return;
+    }
+
+    for (auto tile = tiles.begin(); tile != tiles.end();) {
+        std::vector<int>& changes = tile->second.changes;
+        changes.erase(std::remove(changes.begin(), changes.end(), version), changes.end());
+
+        auto previousPrint = before.find(tile->first);
+        if (hasNext) {
+            auto nextPrint = after.find(tile->first);
+            if (nextPrint != after.end()) {
+                bool changed = !sameLayout || previousPrint == before.end() || previousPrint->second != nextPrint->second;
+                auto pos = std::lower_bound(changes.begin(), changes.end(), next->first);
+                bool listed = pos != changes.end() && *pos == next->first;
+                if (changed && !listed) {
+                    changes.insert(pos, next->first);
+                } else if (!changed && listed) {
+                    changes.erase(pos);
+                }
+            }
+        } else if (previousPrint != before.end()) {
+            tile->second.fingerprint = previousPrint->second;
+        }
+        tile = changes.empty() ? tiles.erase(tile) : std::next(tile);
+    }
+
+    layouts.erase(it);
+}
+
+bool BlameIndex::loadFingerprints(int version, std::map<uint32_t, uint64_t>& fingerprints) {
+    VersionHashes record;
+    if (!HashStore::load(version, record)) {
+        return false;
+    }
+    std::vector<cv::Point> cells;
+    std::vector<uint64_t> values = tileFingerprints(record, cells);
+    for (size_t t = 0; t < values.size(); t++) {
+        fingerprints[cellKey(cells[t])] = values[t];
+    }
+    return true;
+}
+
+bool BlameIndex::contains(int version) const {
+    return layouts.count(version) > 0;
+}
+
+int BlameIndex::latestVersion() const {
+    return layouts.empty() ? 0 : layouts.rbegin()->first;
+}
+
+// One binary search in the history of each queried tile
+std::vector<BlameIndex::TileBlame> BlameIndex::blame(int version, const cv::Rect& area) const {
+    auto layout = layouts.find(version);
+    if (layout == layouts.end()) {
+        throw std::runtime_error("Version " + std::to_string(version) + " is not in the blame index.");
+    }
+
+    std::vector<cv::Point> cells;
+    std::vector<cv::Rect> regions = Quadtree::nodeRegions(layout->second.imageSize, layout->second.minSize, DEPTH, &cells);
+
+    std::vector<TileBlame> result;
+    for (size_t t = 0; t < regions.size(); t++) {
+        if (!area.empty() && (regions[t] & area).area() == 0) continue;
+
+        TileBlame entry{regions[t], version};
+        auto tile = tiles.find(cellKey(cells[t]));
+        if (tile != tiles.end()) {
+            const std::vector<int>& changes = tile->second.changes;
+            auto pos = std::upper_bound(changes.begin(), changes.end(), version);
+            if (pos != changes.begin()) {
+                entry.version = *std::prev(pos);
+            }
+        }
+        result.push_back(entry);
+    }
+    return result;
+}
+
+uint32_t BlameIndex::cellKey(const cv::Point& cell) {
+    return (static_cast<uint32_t>(cell.y) << 16) | static_cast<uint32_t>(cell.x);
+}
@@ -0,0 +1,74 @@
+#ifndef BLAMEINDEX_H
+#define BLAMEINDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "HashStore.h"
+
+// Persistent tile history for blame: the image is cut into the Quadtree nodes at a fixed
+// depth, and for each tile position the index keeps the versions in which its content
+// changed. Updating it on add only compares leaf checksums already in the hash record.
+class BlameIndex {
+public:
+    static const int DEPTH = 5; // Up to 32 x 32 tiles
+
+    // A tile and the version that last changed it
+    struct TileBlame {
+        cv::Rect region;
+        int version;
+    };
+
+    bool load(const std::string& filename = "blame_index.dat");
+    void save(const std::string& filename = "blame_index.dat") const;
+
+    // Records a version newer than every indexed one
+    void update(int version, const VersionHashes& record);
+    // Same as load, update and save, but appends the version's changes to the index file
+    // without reading more than its first and last lines. The latest indexed version's
+    // fingerprints come from its stored hash record. Returns false, leaving the file alone,
+    // when there is no usable index; the index is removed if that record is missing.
+    static bool append(int version, const VersionHashes& record, const std::string& filename = "blame_index.dat");
+    // Forgets a version. Whether the next indexed version changed each tile is decided again
+    // from the stored hash records of it and the previous version; without them the whole
+    // index is dropped and blame rebuilds it.
+    void remove(int version);
+    bool contains(int version) const;
+    int latestVersion() const;
+
+    // Blame for the tiles of `version` overlapping `area` (all tiles if empty), in traversal
+    // order. Throws if the version is not indexed.
+    std::vector<TileBlame> blame(int version, const cv::Rect& area = cv::Rect()) const;
+
+private:
+    struct Layout {
+        cv::Size imageSize;
+        int minSize = 0;
+
+        bool operator==(const Layout& other) const {
+            return imageSize == other.imageSize && minSize == other.minSize;
+        }
+    };
+
+    struct History {
+        uint64_t fingerprint = 0;  // Content of the tile in the latest version
+        std::vector<int> changes;  // Versions in which the content changed, ascending
+    };
+
+    static const int FORMAT_VERSION = 2;
+
+    static uint32_t cellKey(const cv::Point& cell);
+    // One fingerprint per tile at DEPTH, folded from the checksums of the leaves inside it
+    static std::vector<uint64_t> tileFingerprints(const VersionHashes& record, std::vector<cv::Point>& cells);
+    // Fingerprints of a stored version by tile key; false if it has no hash record
+    static bool loadFingerprints(int version, std::map<uint32_t, uint64_t>& fingerprints);
+    // Latest indexed version, read from the last line of an index file in this format
+    static bool readLatestVersion(const std::string& filename, int& version);
+
+    std::map<int, Layout> layouts;       // Indexed versions
+    std::map<uint32_t, History> tiles;   // By cell position at DEPTH
+};
+
+#endif // BLAMEINDEX_H
@@ -0,0 +1,231 @@
+#include "Bundle.h"
+#include "LeafHasher.h"
+#include "Quadtree.h"
+#include "Repository.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+void writeValue(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+void writeArray(std::ostream& out, const std::vector<T>& values) {
+    writeValue(out, static_cast<uint64_t>(values.size()));
+    out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+void writeString(std::ostream& out, const std::string& value) {
+    writeValue(out, static_cast<uint32_t>(value.size()));
+    out.write(value.data(), static_cast<std::streamsize>(value.size()));
+}
+
+template <typename T>
+void readValue(std::istream& in, T& value) {
+    if (!in.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+        throw std::runtime_error("The bundle is truncated.");
+    }
+}
+
+// Lengths are checked against what is left of the file before anything is allocated
+uint64_t remainingBytes(std::istream& in) {
+    std::streampos here = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streampos end = in.tellg();
+    in.seekg(here);
+    return here < 0 || end < here ? 0 : static_cast<uint64_t>(end - here);
+}
+
+template <typename T>
+void readArray(std::istream& in, std::vector<T>& values) {
+    uint64_t count = 0;
+    readValue(in, count);
+    if (count > remainingBytes(in) / sizeof(T)) {
+        throw std::runtime_error("The bundle is truncated.");
+    }
+    values.resize(static_cast<size_t>(count));
+    in.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(count * sizeof(T)));
+}
+
+void readString(std::istream& in, std::string& value) {
+    uint32_t length = 0;
+    readValue(in, length);
+    if (length > remainingBytes(in)) {
+        throw std::runtime_error("The bundle is truncated.");
+    }
+    value.resize(length);
+    in.read(&value[0], length);
+}
+
+} // namespace
+
+MerkleTree Bundle::checksumTree(const VersionHashes& record) {
+    std::vector<std::string> blocks;
+    blocks.reserve(record.checksums.size());
+    char hex[17];
+    for (uint64_t checksum : record.checksums) {
+        std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(checksum));
+        blocks.emplace_back(hex);
+    }
+    return MerkleTree(blocks);
+}
+
+bool Bundle::loadContentRecord(const std::string& directory, int version, VersionHashes& record) {
+    std::string snapshot = Repository::snapshotPath(version, directory);
+    if (!Repository::isLegacySnapshot(snapshot)) {
+        std::string prefix = directory.empty() ? "" : directory + "/";
+        if (HashStore::loadFile(prefix + HashStore::pathFor(version), record)) {
+            return true;
+        }
+    }
+
+    cv::Mat image = cv::imread(snapshot, cv::IMREAD_UNCHANGED);
+    if (image.cols < 16 || image.rows < 16) {
+        return false;
+    }
+    record = LeafHasher::buildRecord(image, 16);
+    return true;
+}
+
+std::vector<uchar> Bundle::packTiles(const cv::Mat& image, const std::vector<cv::Rect>& regions,
+                                     const std::vector<uint32_t>& tiles) {
+    size_t total = 0;
+    for (uint32_t tile : tiles) {
+        total += static_cast<size_t>(regions[tile].area()) * image.elemSize();
+    }
+
+    std::vector<uchar> data(total);
+    uchar* out = data.data();
+    for (uint32_t tile : tiles) {
+        const cv::Rect& region = regions[tile];
+        const size_t rowBytes = static_cast<size_t>(region.width) * image.elemSize();
+        for (int y = region.y; y < region.y + region.height; y++) {
+            std::memcpy(out, image.ptr<uchar>(y) + static_cast<size_t>(region.x) * image.elemSize(), rowBytes);
+            out += rowBytes;
+        }
+    }
+    return data;
+}
+
+void Bundle::unpackTiles(const std::vector<uchar>& data, const std::vector<cv::Rect>& regions,
+                         const std::vector<uint32_t>& tiles, cv::Mat& image) {
+    const uchar* in = data.data();
+    const uchar* end = in + data.size();
+    for (uint32_t tile : tiles) {
+        if (tile >= regions.size()) {
+            throw std::runtime_error("The bundle refers to a leaf outside the image.");
+        }
+        const cv::Rect& region = regions[tile];
+        const size_t rowBytes = static_cast<size_t>(region.width) * image.elemSize();
+        if (static_cast<size_t>(end - in) < rowBytes * region.height) {
+            throw std::runtime_error("The bundle holds less leaf data than it lists.");
+        }
+        for (int y = region.y; y < region.y + region.height; y++) {
+            std::memcpy(image.ptr<uchar>(y) + static_cast<size_t>(region.x) * image.elemSize(), in, rowBytes);
+            in += rowBytes;
+        }
+    }
+    if (in != end) {
+        throw std::runtime_error("The bundle holds more leaf data than it lists.");
+    }
+}
+
+Bundle::Writer::Writer(const std::string& path)
+    : path(path), tempPath(path + ".tmp"), out(tempPath, std::ios::binary | std::ios::trunc) {
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + tempPath);
+    }
+    out.write("VBDL", 4);
+    writeValue(out, FORMAT_VERSION);
+}
+
+// A bundle that was never closed is incomplete; it is removed rather than left behind
+Bundle::Writer::~Writer() {
+    if (!closed) {
+        out.close();
+        std::remove(tempPath.c_str());
+    }
+}
+
+void Bundle::Writer::write(const BundleEntry& entry) {
+    writeValue(out, static_cast<uint8_t>(1));
+    writeString(out, entry.contentRoot);
+    writeString(out, entry.baseRoot);
+    const int32_t layout[] = {entry.imageSize.width, entry.imageSize.height, entry.minSize, entry.type};
+    out.write(reinterpret_cast<const char*>(layout), sizeof(layout));
+    writeArray(out, entry.tiles);
+    writeArray(out, entry.checksums);
+    writeArray(out, entry.data);
+    if (!out) {
+        throw std::runtime_error("Could not write the bundle to " + tempPath);
+    }
+}
+
+void Bundle::Writer::close() {
+    writeValue(out, static_cast<uint8_t>(0));
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Could not write the bundle to " + tempPath);
+    }
+    std::remove(path.c_str());
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Could not replace file: " + path);
+    }
+    closed = true;
+}
+
+Bundle::Reader::Reader(const std::string& path) : in(path, std::ios::binary) {
+    if (!in.is_open()) {
+        throw std::runtime_error("Could not open bundle: " + path);
+    }
+    char magic[4];
+    uint32_t formatVersion = 0;
+    if (!in.read(magic, 4) || std::memcmp(magic, "VBDL", 4) != 0) {
+        throw std::runtime_error(path + " is not a bundle.");
+    }
+    readValue(in, formatVersion);
+    if (formatVersion != FORMAT_VERSION) {
+        throw std::runtime_error("Unsupported bundle format version " + std::to_string(formatVersion) + ".");
+    }
+}
+
+bool Bundle::Reader::next(BundleEntry& entry) {
+    uint8_t more = 0;
+    readValue(in, more);
+    if (!more) {
+        return false;
+    }
+
+    entry = BundleEntry();
+    readString(in, entry.contentRoot);
+    readString(in, entry.baseRoot);
+    int32_t layout[4];
+    readValue(in, layout);
+    entry.imageSize = cv::Size(layout[0], layout[1]);
+    entry.minSize = layout[2];
+    entry.type = layout[3];
+    readArray(in, entry.tiles);
+    readArray(in, entry.checksums);
+    readArray(in, entry.data);
+    if (!in) {
+        throw std::runtime_error("The bundle is truncated.");
+    }
+
+    if (entry.imageSize.width < 16 || entry.imageSize.height < 16 || entry.minSize <= 0) {
+        throw std::runtime_error("A bundle entry does not describe a valid leaf layout.");
+    }
+    if (entry.checksums.size() != entry.tiles.size() || (entry.baseRoot.empty() && !entry.tiles.empty())) {
+        throw std::runtime_error("A bundle entry lists leaves it does not carry.");
+    }
+    const size_t leafCount = Quadtree::leafRegions(entry.imageSize, entry.minSize).size();
+    for (size_t i = 0; i < entry.tiles.size(); i++) {
+        if (entry.tiles[i] >= leafCount || (i > 0 && entry.tiles[i] <= entry.tiles[i - 1])) {
+            throw std::runtime_error("A bundle entry lists leaves outside its layout.");
+        }
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "HashStore.h"
+#include "MerkleTree.h"
+
+// One version carried by a bundle: its leaf layout plus either the whole snapshot, or the
+// raw bytes and checksums of the leaves that differ from a base version
+struct BundleEntry {
+    std::string contentRoot;         // Root of the version's checksum tree
+    std::string baseRoot;            // Content root of the base version; empty for a whole snapshot
+    cv::Size imageSize;
+    int minSize = 0;
+    int type = 0;                    // cv::Mat type of the image
+    std::vector<uint32_t> tiles;     // Leaves carried as raw bytes, ascending (delta entries only)
+    std::vector<uint64_t> checksums; // Checksum of each carried leaf; the rest are the base's
+    std::vector<uchar> data;         // The PNG snapshot, or the carried leaves' bytes in order
+};
+
+// Moves versions between repository directories. Versions are matched by the root of a
+// Merkle tree over their leaf checksums: unlike the stored tree over perceptual hashes,
+// equal roots there mean equal pixels. A version the destination lacks is sent as the
+// leaves where its checksum tree differs from a version the destination already has.
+//
+// Bundle file: "VBDL", a format version, then each entry preceded by a 1 byte and the
+// whole file ended by a 0 byte. Values are in native byte order, like the other binary files.
+class Bundle {
+public:
+    static const uint32_t FORMAT_VERSION = 1;
+
+    static MerkleTree checksumTree(const VersionHashes& record);
+
+    // Record whose checksums describe a version's snapshot as stored in `directory` (empty
+    // for the working directory). Legacy JPEG snapshots, which no longer match their stored
+    // checksums, and versions without a record are hashed from the decoded snapshot.
+    static bool loadContentRecord(const std::string& directory, int version, VersionHashes& record);
+
+    // Raw bytes of the given leaves, row by row
+    static std::vector<uchar> packTiles(const cv::Mat& image, const std::vector<cv::Rect>& regions,
+                                        const std::vector<uint32_t>& tiles);
+    // Copies packed leaves into `image`; throws if the data does not match the leaves
+    static void unpackTiles(const std::vector<uchar>& data, const std::vector<cv::Rect>& regions,
+                            const std::vector<uint32_t>& tiles, cv::Mat& image);
+
+    // Writes a bundle beside `path` and moves it into place on close(), so an interrupted
+    // create never leaves a truncated bundle behind
+    class Writer {
+    public:
+        explicit Writer(const std::string& path);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        void write(const BundleEntry& entry);
+        void close();
+
+    private:
+        std::string path;
+        std::string tempPath;
+        std::ofstream out;
+        bool closed = false;
+    };
+
+    // Reads entries one at a time, so a bundle never has to fit in memory
+    class Reader {
+    public:
+        explicit Reader(const std::string& path);
+
+        // Returns false after the last entry; throws on a truncated or malformed bundle
+        bool next(BundleEntry& entry);
+
+    private:
+        std::ifstream in;
+    };
+};
+
+#endif // BUNDLE_H
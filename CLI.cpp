@@ -1,55 +1,320 @@
 #include "CLI.h"
-#include "Global.h"
 #include "ImageProcessor.h"
 #include "MerkleTree.h"
 #include "Quadtree.h"
 #include "ImageComparer.h"
 #include "Utils.h"
+#include "LeafHasher.h"
+#include "HashStore.h"
+#include "SimilarityIndex.h"
+#include "BoundedQueue.h"
+#include "Verifier.h"
+#include "ImageAligner.h"
+#include "DiffReport.h"
+#include "BlameIndex.h"
+#include "TileMerge.h"
+#include "AllocProfiler.h"
+#include "Bundle.h"
 #include <iostream>
 #include <stdexcept>
 #include <vector>
 #include <map>
+#include <memory>
+#include <set>
+#include <iterator>
 #include <sstream>
 #include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+// Parses "x,y,w,h" into a rectangle with a non-negative origin and a positive size
+static bool parseRect(const std::string& value, cv::Rect& rect) {
+    std::istringstream iss(value);
+    int x, y, width, height;
+    char c1, c2, c3;
+    if (!(iss >> x >> c1 >> y >> c2 >> width >> c3 >> height) || c1 != ',' || c2 != ',' || c3 != ',' ||
+        !iss.eof() || x < 0 || y < 0 || width <= 0 || height <= 0) {
+        return false;
+    }
+    
+    rect = cv::Rect(x, y, width, height);
+    return true;
+}
+
+// Removes a "--roi x,y,w,h" option from a command's arguments into `roi`
+// Returns false if the option is present but malformed
+static bool extractRoiOption(std::string& args, cv::Rect& roi) {
+    size_t pos = args.find("--roi");
+    if (pos == std::string::npos) {
+        return true;
+    }
+    
+    size_t valueStart = args.find_first_not_of(' ', pos + 5);
+    if (valueStart == std::string::npos || valueStart == pos + 5) {
+        return false;
+    }
+    size_t valueEnd = args.find(' ', valueStart);
+    std::string value = args.substr(valueStart, valueEnd == std::string::npos ? std::string::npos : valueEnd - valueStart);
+    args.erase(pos, (valueEnd == std::string::npos ? args.size() : valueEnd) - pos);
+    
+    return parseRect(value, roi);
+}
+
+// Removes "--<name> [value]" from a command's arguments; the value is the following word
+// unless that is another option. Returns false if the option is absent.
+static bool extractOption(std::string& args, const std::string& name, std::string& value) {
+    std::string flag = "--" + name;
+    size_t pos = args.find(flag);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    
+    value.clear();
+    size_t end = pos + flag.size();
+    size_t valueStart = args.find_first_not_of(' ', end);
+    if (valueStart != std::string::npos && valueStart > end && args.compare(valueStart, 2, "--") != 0) {
+        size_t valueEnd = args.find(' ', valueStart);
+        value = args.substr(valueStart, valueEnd == std::string::npos ? std::string::npos : valueEnd - valueStart);
+        end = valueEnd == std::string::npos ? args.size() : valueEnd;
+    }
+    args.erase(pos, end - pos);
+    return true;
+}
+
+// Removes the report options shared by compare and advcompare:
+//   --output <path|->   write a structured report instead of rendering ("-" = stdout)
+//   --format json|bin   report format (default json, or bin for paths ending in .bin)
+//   --render [path]     also render the highlighted image, optionally to another path
+// Returns false if an option is malformed
+static bool extractDiffOutputOptions(std::string& args, DiffOutputOptions& output) {
+    std::string value;
+    bool hasFormat = false;
+    if (extractOption(args, "format", value)) {
+        if (!DiffReportWriter::parseFormat(value, output.format)) {
+            return false;
+        }
+        hasFormat = true;
+    }
+    if (extractOption(args, "output", value)) {
+        if (value.empty()) {
+            return false;
+        }
+        output.reportPath = value;
+    } else if (hasFormat) {
+        output.reportPath = "-";
+    }
+    if (!hasFormat && output.reportPath.size() > 4 &&
+        output.reportPath.compare(output.reportPath.size() - 4, 4, ".bin") == 0) {
+        output.format = DiffFormat::Binary;
+    }
+    
+    // Rendering is skipped when a report is requested, unless asked for explicitly
+    output.render = output.reportPath.empty();
+    if (extractOption(args, "render", value)) {
+        output.render = true;
+        output.renderPath = value;
+    }
+    return true;
+}
+
+// Loads a version's hash record, or hashes its snapshot and stores the record for versions
+// that predate the hash store (`rebuilt` is then set). The record is stored under the
+// repository lock and only while the version still exists. Returns false if neither exists.
+static bool loadOrBuildRecord(Repository& repository, int version, VersionHashes& record, bool& rebuilt) {
+    rebuilt = false;
+    if (HashStore::load(version, record)) {
+        return true;
+    }
+    cv::Mat image = cv::imread(Repository::snapshotPath(version), cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+        return false;
+    }
+    record = LeafHasher::buildRecord(image, 16);
+    repository.locked([&](const Repository::VersionMap& current) {
+        if (current.count(version)) {
+            HashStore::save(version, record);
+        }
+    });
+    rebuilt = true;
+    return true;
+}
+
+// The leaves of a stored hash record that overlap a region
+struct RegionTiles {
+    cv::Size imageSize;
+    int minSize = 0;
+    std::vector<cv::Rect> regions;
+    std::vector<uint64_t> checksums;
+    
+    bool sameAs(const RegionTiles& other) const {
+        return imageSize == other.imageSize && minSize == other.minSize && checksums == other.checksums;
+    }
+};
+
+// Progress on one line of stderr, rewritten in place: count, rate and time left
+static void printProgress(const ProgressStatus& status) {
+    std::ostringstream line;
+    line << "\r" << status.stage << ": " << status.done;
+    if (status.total > 0) {
+        line << "/" << status.total << " (" << (100 * status.done / status.total) << "%)";
+    }
+    line << ", " << std::fixed << std::setprecision(0) << status.itemsPerSecond << " " << status.unit << "/s";
+    if (!status.finished && status.secondsLeft >= 0) {
+        line << ", " << std::setprecision(1) << status.secondsLeft << "s left";
+    }
+    // Blanks cover the tail of a longer previous line
+    line << "        ";
+    if (status.finished) {
+        line << "\n";
+    }
+    std::cerr << line.str() << std::flush;
+}
+
+CancellationToken CLI::commandToken;
+std::atomic<bool> CLI::commandRunning(false);
+
+// Only touches lock-free atomics
+bool CLI::interrupt() {
+    if (!commandRunning.load() || commandToken.isCancelled()) {
+        return false;
+    }
+    commandToken.cancel();
+    return true;
+}
 
 // Main CLI command loop
 void CLI::run() {
     // Load the version repository
-    loadVersionRepository();
+    repository.load();
     
     std::string command;
     while (true) {
+        // An interrupt at the prompt exits; while a command runs it only cancels the command
+        commandRunning = false;
         std::cout << "Versionary> ";
         std::getline(std::cin, command);
+        commandToken.reset();
+        commandRunning = true;
+        AllocProfiler::CommandScope profile(command);
 
         if (command == "exit") {
             break;
+        } else if (command.rfind("add-sequence ", 0) == 0) {
+            handleAddSequence(command.substr(13));
+        } else if (command.rfind("add --incremental ", 0) == 0) {
+            handleAdd(command.substr(18), true);
         } else if (command.rfind("add ", 0) == 0) {
             handleAdd(command.substr(4));
         } else if (command == "commit") {
             handleCommit();
         } else if (command.rfind("compare ", 0) == 0) {
-            std::istringstream iss(command.substr(8));
+            std::string args = command.substr(8);
+            cv::Rect roi;
+            if (!extractRoiOption(args, roi)) {
+                std::cerr << "Invalid --roi option. Use: --roi x,y,width,height\n";
+                continue;
+            }
+            const bool hasOutputOptions = args.find("--output") != std::string::npos ||
+                                          args.find("--format") != std::string::npos ||
+                                          args.find("--render") != std::string::npos;
+            DiffOutputOptions output;
+            if (!extractDiffOutputOptions(args, output)) {
+                std::cerr << "Invalid output options. Use: --output <path|-> [--format json|bin] [--render [path]]\n";
+                continue;
+            }
+            
+            // "--level N" compares pyramid level N (1/2^N scale) instead of the full snapshots
+            int level = 0;
+            size_t levelPos = args.find("--level");
+            if (levelPos != std::string::npos) {
+                std::istringstream levelStream(args.substr(levelPos + 7));
+                if (!(levelStream >> level) || level < 1 || level > PyramidStore::LEVELS) {
+                    std::cerr << "Invalid --level option. Use: --level 1-" << PyramidStore::LEVELS << "\n";
+                    continue;
+                }
+                size_t valueEnd = args.find_first_not_of(' ', levelPos + 7);
+                valueEnd = args.find(' ', valueEnd);
+                args.erase(levelPos, (valueEnd == std::string::npos ? args.size() : valueEnd) - levelPos);
+            }
+            
+            // "--estimate [margin%]" samples leaves instead of running the full diff
+            size_t estimatePos = args.find("--estimate");
+            if (estimatePos != std::string::npos) {
+                // The estimate samples full-resolution leaves and only prints a summary
+                if (level > 0 || hasOutputOptions) {
+                    std::cerr << "--estimate cannot be combined with --level, --output, --format or --render. "
+                              << "Use: compare <version1> <version2> --estimate [margin%] [--roi x,y,w,h]\n";
+                    continue;
+                }
+                args.erase(estimatePos, 10);
+                std::istringstream iss(args);
+                std::string v1, v2;
+                double marginPercent = 1.0; // Default precision: +/- 1 percentage point
+                if (!(iss >> v1 >> v2)) {
+                    std::cerr << "Invalid compare command. Use: compare <version1> <version2> --estimate [margin%] [--roi x,y,w,h]\n";
+                    continue;
+                }
+                iss >> marginPercent;
+                handleEstimate(v1, v2, marginPercent, roi);
+                continue;
+            }
+            
+            std::istringstream iss(args);
             std::string v1, v2;
             int sensitivity = 65; // Default sensitivity
             
             if (!(iss >> v1 >> v2)) {
-                std::cerr << "Invalid compare command. Use: compare <version1> <version2> [sensitivity]\n";
+                std::cerr << "Invalid compare command. Use: compare <version1> <version2> [sensitivity] [--roi x,y,w,h]\n";
                 continue;
             }
             
             // Optional sensitivity parameter
             iss >> sensitivity;
             
-            handleCompare(v1, v2, sensitivity);
+            handleCompare(v1, v2, sensitivity, roi, level, output);
         } else if (command.rfind("advcompare ", 0) == 0) {
-            std::istringstream iss(command.substr(11));
+            std::string args = command.substr(11);
+            cv::Rect roi;
+            if (!extractRoiOption(args, roi)) {
+                std::cerr << "Invalid --roi option. Use: --roi x,y,width,height\n";
+                continue;
+            }
+            DiffOutputOptions output;
+            if (!extractDiffOutputOptions(args, output)) {
+                std::cerr << "Invalid output options. Use: --output <path|-> [--format json|bin] [--render [path]]\n";
+                continue;
+            }
+            
+            // "--align [affine|homography]" registers the second version onto the first
+            bool align = false;
+            AlignmentModel model = AlignmentModel::Affine;
+            size_t alignPos = args.find("--align");
+            if (alignPos != std::string::npos) {
+                align = true;
+                size_t end = alignPos + 7;
+                size_t valueStart = args.find_first_not_of(' ', end);
+                if (valueStart != std::string::npos && args.compare(valueStart, 10, "homography") == 0) {
+                    model = AlignmentModel::Homography;
+                    end = valueStart + 10;
+                } else if (valueStart != std::string::npos && args.compare(valueStart, 6, "affine") == 0) {
+                    end = valueStart + 6;
+                }
+                args.erase(alignPos, end - alignPos);
+            }
+            
+            std::istringstream iss(args);
             std::string v1, v2;
             int chunkSize = 16; // Default chunk size
             int sensitivity = 10; // Default sensitivity
             
             if (!(iss >> v1 >> v2)) {
-                std::cerr << "Invalid advcompare command. Use: advcompare <version1> <version2> [chunkSize] [sensitivity]\n";
+                std::cerr << "Invalid advcompare command. Use: advcompare <version1> <version2> [chunkSize] [sensitivity] [--roi x,y,w,h]\n";
                 continue;
             }
             
@@ -59,13 +324,46 @@ void CLI::run() {
             
             iss >> sensitivity;
             
-            handleAdvancedCompare(v1, v2, chunkSize, sensitivity);
+            handleAdvancedCompare(v1, v2, chunkSize, sensitivity, roi, align, model, output);
         } else if (command.rfind("view ", 0) == 0) {
-            handleView(command.substr(5));
+            std::string args = command.substr(5);
+            bool full = false;
+            size_t fullPos = args.find(" --full");
+            if (fullPos != std::string::npos) {
+                args.erase(fullPos, 7);
+                full = true;
+            }
+            handleView(args, full);
         } else if (command.rfind("delete ", 0) == 0) {
             handleDelete(command.substr(7));
         } else if (command == "list") {
             handleList();
+        } else if (command == "list --thumbnails") {
+            handleList(true);
+        } else if (command.rfind("find ", 0) == 0) {
+            handleFind(command.substr(5));
+        } else if (command == "matrix" || command.rfind("matrix ", 0) == 0) {
+            handleMatrix(command.size() > 7 ? command.substr(7) : "");
+        } else if (command == "verify" || command.rfind("verify ", 0) == 0) {
+            handleVerify(command.size() > 7 ? command.substr(7) : "all");
+        } else if (command == "blame" || command.rfind("blame ", 0) == 0) {
+            handleBlame(command.size() > 6 ? command.substr(6) : "");
+        } else if (command.rfind("merge ", 0) == 0) {
+            handleMerge(command.substr(6));
+        } else if (command.rfind("bundle create ", 0) == 0) {
+            std::istringstream iss(command.substr(14));
+            std::string destination, bundlePath, extra;
+            if (!(iss >> destination >> bundlePath) || (iss >> extra)) {
+                std::cerr << "Error: Use: bundle create <destination-dir> <bundle-file>\n";
+            } else {
+                handleBundleCreate(destination, bundlePath);
+            }
+        } else if (command.rfind("bundle apply ", 0) == 0) {
+            handleBundleApply(command.substr(13));
+        } else if (command.rfind("bisect ", 0) == 0) {
+            handleBisect(command.substr(7));
+        } else if (command == "log" || command == "log --stat") {
+            handleLog(command == "log --stat");
         } else if (command == "help") {
             printHelp();
         } else {
@@ -75,74 +373,289 @@ void CLI::run() {
 }
 
 // Adds a new image to the repository
-void CLI::handleAdd(const std::string& filePath) {
+// In incremental mode, tiles unchanged since the current version reuse its stored hashes
+void CLI::handleAdd(const std::string& filePath, bool incremental) {
     try {
         std::cout << "Processing image...\n";
-        cv::Mat image = ImageProcessor::readImage(filePath);
-        cv::Mat grayImage = ImageProcessor::convertToGrayscale(image);
+        cv::Mat image;
+        {
+            AllocProfiler::Scope stage(AllocStage::Decode);
+            image = ImageProcessor::readImage(filePath);
+        }
 
-        if (grayImage.cols < 16 || grayImage.rows < 16) {
+        if (image.cols < 16 || image.rows < 16) {
             throw std::runtime_error("Image dimensions are too small for Quadtree processing (minimum 16x16).");
         }
 
-        Quadtree quadtree(grayImage, 16); // Minimum chunk size is 16x16
+        auto startTime = std::chrono::high_resolution_clock::now();
 
-        std::vector<std::string> hashes;
-        collectLeafHashes(quadtree.getRoot(), hashes);
+        // Hash the Quadtree leaves (minimum chunk size 16x16) straight from the decoded image
+        AllocProfiler::Scope hashStage(AllocStage::Hash);
+        Progress progress(&commandToken, printProgress);
+        VersionHashes record;
+        VersionHashes parent;
+        // The parent is the latest version that still exists; currentVersion() is the highest
+        // number ever handed out, which may have been removed
+        auto existing = repository.snapshot();
+        int parentVersion = existing->empty() ? 0 : existing->rbegin()->first;
+        if (incremental && parentVersion > 0 && HashStore::load(parentVersion, parent)) {
+            size_t rehashed = 0;
+            record = LeafHasher::buildRecordIncremental(image, 16, parent, &rehashed, &progress);
+            std::cout << "Incremental add against version " << parentVersion << ": rehashed "
+                      << rehashed << " of " << record.leafHashes.size() << " tiles.\n";
+        } else {
+            if (incremental && parentVersion == 0) {
+                std::cout << "No earlier version to compare against; hashing every tile.\n";
+            } else if (incremental) {
+                std::cout << "No stored hashes for version " << parentVersion << "; hashing every tile.\n";
+            }
+            record = LeafHasher::buildRecord(image, 16, &progress);
+        }
 
-        MerkleTree tree(hashes);
-        std::string rootHash = tree.getRootHash();
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+
+        std::string rootHash = record.rootHash();
 
         std::cout << "Image added successfully. Root hash: " << rootHash << "\n";
+        std::cout << "Hashed " << record.leafHashes.size() << " tiles in " << duration.count() << "ms.\n";
 
-        // Store the version information
-        versionRepository[++currentVersion] = rootHash;
-        
-        // Save the image for future reference
-        cv::imwrite("version_" + std::to_string(currentVersion) + ".jpg", image);
-        std::cout << "Image saved as version_" + std::to_string(currentVersion) + ".jpg\n";
+        // Encode the snapshot and build the signature before taking the repository lock
+        std::vector<uchar> encoded;
+        VersionSignature signature;
+        EncodedPyramid pyramid;
+        {
+            AllocProfiler::Scope stage(AllocStage::Encode);
+            if (!cv::imencode(".png", image, encoded)) {
+                throw std::runtime_error("Could not encode the image.");
+            }
+            signature = LeafHasher::buildSignature(image);
+            pyramid = PyramidStore::build(image);
+        }
 
-        // Save the version repository
-        saveVersionRepository();
+        // Last checkpoint: once the version is being stored it is completed
+        progress.throwIfCancelled();
+        int version = storeVersion(record, encoded, signature, pyramid);
+        std::cout << "Image saved as " << Repository::newSnapshotPath(version) << "\n";
+    } catch (const OperationCancelled&) {
+        std::cerr << "\nCancelled; no version was added.\n";
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
     }
 }
 
-// Collects hashes from all leaf nodes in the Quadtree
-void CLI::collectLeafHashes(std::shared_ptr<QuadtreeNode> node, std::vector<std::string>& hashes) {
-    if (!node) return;
-    
-    if (node->isLeaf()) {
-        std::string hash = hashImageChunk(node->chunk);
-        hashes.push_back(hash);
-    } else {
-        collectLeafHashes(node->topLeft, hashes);
-        collectLeafHashes(node->topRight, hashes);
-        collectLeafHashes(node->bottomLeft, hashes);
-        collectLeafHashes(node->bottomRight, hashes);
-    }
+// Records a new version and writes its files; safe to call from any thread
+// The files are written while the number is reserved, so the entry only appears once they exist
+int CLI::storeVersion(const VersionHashes& record, const std::vector<uchar>& encoded, const VersionSignature& signature,
+                      const EncodedPyramid& pyramid) {
+    AllocProfiler::Scope stage(AllocStage::Store);
+    std::string rootHash = record.rootHash();
+    return repository.addVersion(rootHash, [&](int newVersion) {
+        // Save the image for future reference, losslessly so verify can re-hash its pixels
+        Repository::writeFileAtomically(Repository::newSnapshotPath(newVersion), encoded.data(), encoded.size());
+        PyramidStore::save(newVersion, pyramid);
+
+        // Keep the per-tile hashes and the similarity signature so later commands can reuse them
+        HashStore::save(newVersion, record);
+        HashStore::saveSignature(newVersion, signature);
+
+        // Register the version with the lookup index used by find. Both indexes are appended
+        // to rather than loaded and rewritten, so an add costs the same however long the history.
+        SimilarityIndex::append(newVersion, rootHash, signature.globalHash);
+
+        // Extend the tile history used by blame; a missing index is rebuilt by blame itself
+        if (!BlameIndex::append(newVersion, record) && newVersion == 1) {
+            BlameIndex blameIndex;
+            blameIndex.update(newVersion, record);
+            blameIndex.save();
+        }
+    });
 }
 
-// Computes a perceptual hash for an image chunk
-std::string CLI::hashImageChunk(const cv::Mat& chunk) {
-    return Utils::computePerceptualHash(chunk);
+// Adds every frame of a video or numbered image sequence as consecutive versions.
+// Four stages run on their own threads, joined by small bounded queues:
+// decode -> hash (incremental against the previous frame) -> encode -> store.
+void CLI::handleAddSequence(const std::string& source) {
+    struct Frame {
+        size_t index = 0;
+        cv::Mat image;
+        VersionHashes record;
+        size_t rehashed = 0;
+        std::vector<uchar> encoded;
+        VersionSignature signature;
+        EncodedPyramid pyramid;
+    };
+    
+    try {
+        // VideoCapture reads video files as well as printf-style patterns such as frame_%04d.png
+        cv::VideoCapture capture(source);
+        if (!capture.isOpened()) {
+            throw std::runtime_error("Could not open video or image sequence: " + source);
+        }
+        
+        // The first frame builds on the current version when its hashes are stored
+        VersionHashes parent;
+        bool haveParent = !repository.empty() && HashStore::load(repository.currentVersion(), parent);
+        
+        const size_t queueCapacity = 4;
+        BoundedQueue<Frame> decoded(queueCapacity);
+        BoundedQueue<Frame> hashed(queueCapacity);
+        BoundedQueue<Frame> encodedFrames(queueCapacity);
+        
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        std::atomic<bool> failed(false);
+        auto fail = [&](std::exception_ptr e) {
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = e;
+            }
+            failed = true;
+            decoded.close();
+            hashed.close();
+            encodedFrames.close();
+        };
+        
+        size_t framesStored = 0;
+        size_t tilesRehashed = 0;
+        size_t tilesTotal = 0;
+        int firstVersion = 0;
+        int lastVersion = 0;
+        
+        // Counted as frames are stored. Once cancelled the decoder stops reading and the frames
+        // in flight are dropped; every version already stored is complete.
+        Progress progress(&commandToken, printProgress);
+        double frameCount = capture.get(cv::CAP_PROP_FRAME_COUNT);
+        progress.begin("Adding frames", frameCount > 0 ? static_cast<size_t>(frameCount) : 0, "frames");
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        std::thread decoder([&] {
+            AllocProfiler::Scope stage(AllocStage::Decode);
+            try {
+                for (size_t index = 0; !failed && !progress.isCancelled(); index++) {
+                    Frame frame;
+                    frame.index = index;
+                    if (!capture.read(frame.image) || frame.image.empty()) break;
+                    if (frame.image.cols < 16 || frame.image.rows < 16) {
+                        throw std::runtime_error("Frame dimensions are too small for Quadtree processing (minimum 16x16).");
+                    }
+                    if (!decoded.push(std::move(frame))) break;
+                }
+                decoded.close();
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        });
+        
+        std::thread hasher([&] {
+            AllocProfiler::Scope stage(AllocStage::Hash);
+            try {
+                Frame frame;
+                while (decoded.pop(frame)) {
+                    if (progress.isCancelled()) break;
+                    if (haveParent) {
+                        frame.record = LeafHasher::buildRecordIncremental(frame.image, 16, parent, &frame.rehashed);
+                    } else {
+                        frame.record = LeafHasher::buildRecord(frame.image, 16);
+                        frame.rehashed = frame.record.leafHashes.size();
+                    }
+                    parent = frame.record;
+                    haveParent = true;
+                    if (!hashed.push(std::move(frame))) break;
+                }
+                hashed.close();
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        });
+        
+        std::thread encoder([&] {
+            AllocProfiler::Scope stage(AllocStage::Encode);
+            try {
+                Frame frame;
+                while (hashed.pop(frame)) {
+                    if (progress.isCancelled()) break;
+                    if (!cv::imencode(".png", frame.image, frame.encoded)) {
+                        throw std::runtime_error("Could not encode frame " + std::to_string(frame.index) + ".");
+                    }
+                    frame.signature = LeafHasher::buildSignature(frame.image);
+                    frame.pyramid = PyramidStore::build(frame.image);
+                    frame.image.release();
+                    if (!encodedFrames.push(std::move(frame))) break;
+                }
+                encodedFrames.close();
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        });
+        
+        // Storage runs on this thread; frames arrive in decode order
+        try {
+            Frame frame;
+            while (encodedFrames.pop(frame)) {
+                if (failed || progress.isCancelled()) break;
+                int version = storeVersion(frame.record, frame.encoded, frame.signature, frame.pyramid);
+                if (framesStored == 0) firstVersion = version;
+                lastVersion = version;
+                framesStored++;
+                tilesRehashed += frame.rehashed;
+                tilesTotal += frame.record.leafHashes.size();
+                progress.advance();
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+        
+        // Unblocks stages waiting on a full queue, so they see the cancellation and exit
+        if (progress.isCancelled()) {
+            decoded.close();
+            hashed.close();
+            encodedFrames.close();
+        }
+        
+        decoder.join();
+        hasher.join();
+        encoder.join();
+        progress.finish();
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(endTime - startTime).count();
+        
+        if (framesStored > 0) {
+            std::cout << "Added " << framesStored << " frames as versions " << firstVersion << "-" << lastVersion << ".\n";
+            std::cout << "Rehashed " << tilesRehashed << " of " << tilesTotal << " tiles; "
+                      << std::fixed << std::setprecision(1) << (seconds > 0 ? framesStored / seconds : 0.0)
+                      << " fps sustained over " << std::setprecision(2) << seconds << "s." << std::defaultfloat << "\n";
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        if (progress.isCancelled()) {
+            std::cerr << "\nCancelled; the remaining frames were not added.\n";
+        } else if (framesStored == 0) {
+            std::cout << "No frames could be read from " << source << ".\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
 }
 
 // Commits the current version
 void CLI::handleCommit() {
     try {
-        if (versionRepository.empty()) {
+        if (repository.empty()) {
             throw std::runtime_error("No images to commit.");
         }
-        std::cout << "Version " << currentVersion << " committed successfully.\n";
+        std::cout << "Version " << repository.currentVersion() << " committed successfully.\n";
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
     }
 }
 
 // Compares two versions using pixel-by-pixel approach
-void CLI::handleCompare(const std::string& version1, const std::string& version2, int sensitivity) {
+void CLI::handleCompare(const std::string& version1, const std::string& version2, int sensitivity, const cv::Rect& roi,
+                        int level, const DiffOutputOptions& output) {
     try {
         // Validate version numbers
         for (char c : version1) {
@@ -160,22 +673,40 @@ void CLI::handleCompare(const std::string& version1, const std::string& version2
         int v1 = std::stoi(version1);
         int v2 = std::stoi(version2);
 
-        if (versionRepository.find(v1) == versionRepository.end() ||
-            versionRepository.find(v2) == versionRepository.end()) {
+        if (!repository.contains(v1) || !repository.contains(v2)) {
             throw std::runtime_error("One or both versions do not exist.");
         }
 
-        std::cout << "Comparing versions " << v1 << " and " << v2 << "...\n";
+        // Progress goes to stderr when stdout carries the report
+        std::ostream& info = output.reportPath == "-" ? std::cerr : std::cout;
+        info << "Comparing versions " << v1 << " and " << v2 << "...\n";
         
-        // Load saved images
-        std::string imagePath1 = "version_" + std::to_string(v1) + ".jpg";
-        std::string imagePath2 = "version_" + std::to_string(v2) + ".jpg";
-        cv::Mat image1 = cv::imread(imagePath1);
-        cv::Mat image2 = cv::imread(imagePath2);
+        // Load saved images, or the requested pyramid level for a coarse compare
+        cv::Mat image1;
+        cv::Mat image2;
+        cv::Rect area = roi;
+        if (level > 0) {
+            image1 = PyramidStore::loadLevel(repository, v1, level);
+            image2 = PyramidStore::loadLevel(repository, v2, level);
+            if (!area.empty()) {
+                // Scale the ROI into level coordinates, keeping at least one pixel
+                int scale = 1 << level;
+                area = cv::Rect(area.x / scale, area.y / scale,
+                                std::max(1, area.width / scale), std::max(1, area.height / scale));
+            }
+            info << "Coarse compare at pyramid level " << level << " (1/" << (1 << level) << " scale).\n";
+        } else {
+            AllocProfiler::Scope stage(AllocStage::Decode);
+            image1 = cv::imread(Repository::snapshotPath(v1), cv::IMREAD_UNCHANGED);
+            image2 = cv::imread(Repository::snapshotPath(v2), cv::IMREAD_UNCHANGED);
+        }
         
         // Create dummy images if needed for demonstration
+        if ((image1.empty() || image2.empty()) && !output.reportPath.empty()) {
+            throw std::runtime_error("Could not load the saved images.");
+        }
         if (image1.empty() || image2.empty()) {
-            std::cout << "Warning: Could not load saved images. Using dummy images for demonstration.\n";
+            info << "Warning: Could not load saved images. Using dummy images for demonstration.\n";
             
             image1 = cv::Mat::zeros(300, 300, CV_8UC3);
             image2 = image1.clone();
@@ -191,13 +722,54 @@ void CLI::handleCompare(const std::string& version1, const std::string& version2
                         cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(255, 255, 255), 2);
         }
         
+        if (!area.empty()) {
+            info << "Restricting the comparison to " << area.width << "x" << area.height
+                      << " at (" << area.x << ", " << area.y << ").\n";
+        }
+        
+        std::string renderPath = output.renderPath.empty() ? "differences_output.jpg" : output.renderPath;
+        
+        // Structured report: find and score the regions without rendering anything
+        if (!output.reportPath.empty()) {
+            auto startTime = std::chrono::high_resolution_clock::now();
+            AllocProfiler::Scope stage(AllocStage::Compare);
+            std::vector<cv::Rect> regions = ImageComparer::findDifferenceRegions(image1, image2, sensitivity, area);
+            
+            DiffReport report;
+            report.method = "compare";
+            report.version1 = v1;
+            report.version2 = v2;
+            report.sensitivity = sensitivity;
+            report.level = level;
+            report.imageSize = image1.size();
+            report.area = area.empty() ? cv::Rect(0, 0, image1.cols, image1.rows) : area;
+            report.regions = ImageComparer::scoreRegions(image1, image2, regions, sensitivity);
+            report.changedArea = DiffReportWriter::coveredFraction(report.regions, report.area);
+            report.elapsedMs = std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - startTime).count();
+            
+            DiffReportWriter::write(report, output.format, output.reportPath);
+            if (output.reportPath != "-") {
+                info << "Found " << regions.size() << " differing regions; report saved to " << output.reportPath << "\n";
+            }
+            if (output.render) {
+                ImageComparer::highlightDifferences(image1, regions, renderPath);
+                info << "Differences have been highlighted and saved to " << renderPath << "\n";
+            }
+            return;
+        }
+        
         // Compare images using specified sensitivity
-        cv::Mat differences = ImageComparer::compareImages(image1, image2, sensitivity);
-        ImageComparer::visualizeDifferences(differences, "differences_output.jpg");
+        cv::Mat differences;
+        {
+            AllocProfiler::Scope stage(AllocStage::Compare);
+            differences = ImageComparer::compareImages(image1, image2, sensitivity, area);
+        }
+        ImageComparer::visualizeDifferences(differences, renderPath);
         
-        std::cout << "Comparing with sensitivity threshold: " << sensitivity 
-                  << " (higher = less sensitive)" << std::endl;
-        std::cout << "Differences have been highlighted and saved to differences_output.jpg\n";
+        info << "Comparing with sensitivity threshold: " << sensitivity 
+             << " (higher = less sensitive)" << std::endl;
+        info << "Differences have been highlighted and saved to " << renderPath << "\n";
         
     } catch (const std::invalid_argument& e) {
         std::cerr << "Error: " << e.what() << "\n";
@@ -208,6 +780,63 @@ void CLI::handleCompare(const std::string& version1, const std::string& version2
     }
 }
 
+// Estimates how much of the image changed between two versions by sampling leaves
+void CLI::handleEstimate(const std::string& version1, const std::string& version2, double marginPercent,
+                         const cv::Rect& roi) {
+    try {
+        // Validate version numbers
+        for (char c : version1 + version2) {
+            if (!std::isdigit(c)) {
+                throw std::invalid_argument("Version numbers must be integers");
+            }
+        }
+        if (marginPercent <= 0.0 || marginPercent > 50.0) {
+            throw std::invalid_argument("Margin must be between 0 and 50 percent");
+        }
+        
+        int v1 = std::stoi(version1);
+        int v2 = std::stoi(version2);
+        
+        std::string root1, root2;
+        if (!repository.rootHash(v1, root1) || !repository.rootHash(v2, root2)) {
+            throw std::runtime_error("One or both versions do not exist.");
+        }
+        
+        // Identical roots mean identical leaf hashes everywhere; no image needs to be read
+        if (root1 == root2) {
+            std::cout << "Versions " << v1 << " and " << v2 << " have the same root hash: 0% changed.\n";
+            return;
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        cv::Mat image1 = cv::imread(Repository::snapshotPath(v1), cv::IMREAD_UNCHANGED);
+        cv::Mat image2 = cv::imread(Repository::snapshotPath(v2), cv::IMREAD_UNCHANGED);
+        if (image1.empty() || image2.empty()) {
+            throw std::runtime_error("Could not load the saved images.");
+        }
+        
+        ChangeEstimate estimate = ImageComparer::estimateChange(image1, image2, marginPercent / 100.0, 16, roi);
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+        
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << "Estimated change: " << estimate.fraction * 100 << "% of tiles (95% CI "
+                  << estimate.lower * 100 << "% - " << estimate.upper * 100 << "%)\n";
+        std::cout << std::defaultfloat;
+        std::cout << "Sampled " << estimate.sampled << " of " << estimate.total << " tiles ("
+                  << estimate.changed << " changed) in " << duration.count() << "ms.\n";
+        if (estimate.sampled == estimate.total) {
+            std::cout << "Every tile was compared, so the figure is exact.\n";
+        }
+    } catch (const std::out_of_range& e) {
+        std::cerr << "Error: Version number out of range\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
 // Deletes a specific version from the repository
 void CLI::handleDelete(const std::string& version) {
     try {
@@ -220,26 +849,42 @@ void CLI::handleDelete(const std::string& version) {
         
         int v = std::stoi(version);
 
-        if (versionRepository.find(v) == versionRepository.end()) {
+        if (!repository.contains(v)) {
             throw std::runtime_error("Version " + version + " does not exist.");
         }
 
         // Don't allow deleting the latest version
-        if (v == currentVersion) {
+        if (v == repository.currentVersion()) {
             throw std::runtime_error("Cannot delete the current version. Please commit a new version first.");
         }
 
-        // Remove the version from the repository
-        versionRepository.erase(v);
-        
-        // Delete the image file
-        std::string imagePath = "version_" + version + ".jpg";
-        if (remove(imagePath.c_str()) != 0) {
-            std::cout << "Warning: Could not delete the image file: " << imagePath << std::endl;
+        // Remove the version from the repository, deleting its files under the same lock
+        bool removed = repository.removeVersion(v, [&](int) {
+            // Delete the image file
+            std::string imagePath = Repository::snapshotPath(v);
+            if (remove(imagePath.c_str()) != 0) {
+                std::cout << "Warning: Could not delete the image file: " << imagePath << std::endl;
+            }
+            HashStore::remove(v);
+            PyramidStore::remove(v);
+            
+            SimilarityIndex index;
+            if (index.load()) {
+                index.remove(v);
+                index.save();
+            }
+            
+            BlameIndex blameIndex;
+            if (blameIndex.load()) {
+                blameIndex.remove(v);
+                blameIndex.save();
+            }
+        });
+        if (!removed) {
+            throw std::runtime_error("Version " + version + " does not exist.");
         }
 
         std::cout << "Version " << v << " has been deleted successfully.\n";
-        saveVersionRepository();
     } catch (const std::invalid_argument& e) {
         std::cerr << "Error: " << e.what() << "\n";
     } catch (const std::out_of_range& e) {
@@ -250,9 +895,11 @@ void CLI::handleDelete(const std::string& version) {
 }
 
 // Lists all versions in the repository
-void CLI::handleList() {
+void CLI::handleList(bool thumbnails) {
     try {
-        if (versionRepository.empty()) {
+        auto versions = repository.snapshot();
+        int currentVersion = repository.currentVersion();
+        if (versions->empty()) {
             std::cout << "No versions found in the repository.\n";
             return;
         }
@@ -264,19 +911,46 @@ void CLI::handleList() {
         std::cout << "Version | Root Hash\n";
         std::cout << "-------------------------\n";
         
-        for (const auto& pair : versionRepository) {
+        for (const auto& pair : *versions) {
             std::string marker = (pair.first == currentVersion) ? " (current)" : "";
             std::cout << pair.first << marker << " | " << pair.second.substr(0, 16) << "...\n";
         }
         std::cout << "-------------------------\n";
-        std::cout << "Total versions: " << versionRepository.size() << "\n";
+        std::cout << "Total versions: " << versions->size() << "\n";
+        
+        if (thumbnails) {
+            // Lay the stored thumbnails out in a grid, each cell labelled with its version
+            const int cell = PyramidStore::THUMBNAIL_SIZE;
+            const int labelHeight = 20;
+            const int columns = std::min<int>(8, static_cast<int>(versions->size()));
+            const int rows = (static_cast<int>(versions->size()) + columns - 1) / columns;
+            cv::Mat sheet(rows * (cell + labelHeight), columns * cell, CV_8UC3, cv::Scalar(32, 32, 32));
+            
+            int index = 0;
+            for (const auto& pair : *versions) {
+                cv::Point origin((index % columns) * cell, (index / columns) * (cell + labelHeight));
+                cv::Mat thumbnail = PyramidStore::loadLevel(repository, pair.first, PyramidStore::THUMBNAIL);
+                if (!thumbnail.empty()) {
+                    // Centre the thumbnail in its cell
+                    cv::Rect target(origin.x + (cell - thumbnail.cols) / 2, origin.y + (cell - thumbnail.rows) / 2,
+                                    thumbnail.cols, thumbnail.rows);
+                    thumbnail.copyTo(sheet(target));
+                }
+                cv::putText(sheet, "v" + std::to_string(pair.first), cv::Point(origin.x + 4, origin.y + cell + 15),
+                            cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 255, 255), 1);
+                index++;
+            }
+            
+            cv::imwrite("contact_sheet.jpg", sheet);
+            std::cout << "Contact sheet saved as contact_sheet.jpg\n";
+        }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
     }
 }
 
 // Displays information about a specific version
-void CLI::handleView(const std::string& version) {
+void CLI::handleView(const std::string& version, bool full) {
     try {
         // Validate version number
         for (char c : version) {
@@ -287,16 +961,27 @@ void CLI::handleView(const std::string& version) {
         
         int v = std::stoi(version);
 
-        if (versionRepository.find(v) == versionRepository.end()) {
+        std::string rootHash;
+        if (!repository.rootHash(v, rootHash)) {
             throw std::runtime_error("Version " + version + " does not exist.");
         }
 
         std::cout << "Viewing version " << v << "...\n";
-        std::cout << "Root hash: " << versionRepository[v] << "\n";
+        std::cout << "Root hash: " << rootHash << "\n";
         
-        // Load and display the image
-        std::string imagePath = "version_" + version + ".jpg";
-        cv::Mat image = cv::imread(imagePath);
+        // Load the smallest pyramid level that still fills the window, unless --full was given
+        const cv::Size displaySize(1280, 960);
+        cv::Mat image;
+        cv::Size fullSize;
+        if (full) {
+            image = cv::imread(Repository::snapshotPath(v));
+            fullSize = image.size();
+        } else if (PyramidStore::fullSize(repository, v, fullSize)) {
+            double scale = std::min(1.0, std::min(static_cast<double>(displaySize.width) / fullSize.width,
+                                                  static_cast<double>(displaySize.height) / fullSize.height));
+            cv::Size needed(static_cast<int>(fullSize.width * scale), static_cast<int>(fullSize.height * scale));
+            image = PyramidStore::load(repository, v, needed);
+        }
         
         if (image.empty()) {
             std::cout << "Warning: Could not load image file for version " << v << std::endl;
@@ -304,7 +989,10 @@ void CLI::handleView(const std::string& version) {
         }
         
         // Display image information
-        std::cout << "Image dimensions: " << image.cols << " x " << image.rows << std::endl;
+        std::cout << "Image dimensions: " << fullSize.width << " x " << fullSize.height << std::endl;
+        if (image.size() != fullSize) {
+            std::cout << "Showing preview: " << image.cols << " x " << image.rows << std::endl;
+        }
         std::cout << "Image channels: " << image.channels() << std::endl;
         
         // Show image in a window
@@ -326,7 +1014,9 @@ void CLI::handleView(const std::string& version) {
 }
 
 // Compares two versions using the advanced Merkle/Quadtree approach
-void CLI::handleAdvancedCompare(const std::string& version1, const std::string& version2, int chunkSize, int sensitivity) {
+void CLI::handleAdvancedCompare(const std::string& version1, const std::string& version2, int chunkSize, int sensitivity,
+                                const cv::Rect& roi, bool align, AlignmentModel model,
+                                const DiffOutputOptions& output) {
     try {
         // Validate version numbers
         for (char c : version1) {
@@ -344,22 +1034,31 @@ void CLI::handleAdvancedCompare(const std::string& version1, const std::string&
         int v1 = std::stoi(version1);
         int v2 = std::stoi(version2);
 
-        if (versionRepository.find(v1) == versionRepository.end() ||
-            versionRepository.find(v2) == versionRepository.end()) {
+        if (!repository.contains(v1) || !repository.contains(v2)) {
             throw std::runtime_error("One or both versions do not exist.");
         }
 
-        std::cout << "Advanced comparison in progress..." << std::endl;
+        // Progress goes to stderr when stdout carries the report
+        std::ostream& info = output.reportPath == "-" ? std::cerr : std::cout;
+        info << "Advanced comparison in progress..." << std::endl;
         
         // Load saved images
-        std::string imagePath1 = "version_" + std::to_string(v1) + ".jpg";
-        std::string imagePath2 = "version_" + std::to_string(v2) + ".jpg";
-        cv::Mat image1 = cv::imread(imagePath1);
-        cv::Mat image2 = cv::imread(imagePath2);
+        std::string imagePath1 = Repository::snapshotPath(v1);
+        std::string imagePath2 = Repository::snapshotPath(v2);
+        cv::Mat image1;
+        cv::Mat image2;
+        {
+            AllocProfiler::Scope stage(AllocStage::Decode);
+            image1 = cv::imread(imagePath1, cv::IMREAD_UNCHANGED);
+            image2 = cv::imread(imagePath2, cv::IMREAD_UNCHANGED);
+        }
         
         // Create dummy images if needed for demonstration
+        if ((image1.empty() || image2.empty()) && !output.reportPath.empty()) {
+            throw std::runtime_error("Could not load the saved images.");
+        }
         if (image1.empty() || image2.empty()) {
-            std::cout << "Warning: Could not load saved images. Using dummy images for demonstration.\n";
+            info << "Warning: Could not load saved images. Using dummy images for demonstration.\n";
             
             image1 = cv::Mat::zeros(300, 300, CV_8UC3);
             image2 = image1.clone();
@@ -374,56 +1073,1128 @@ void CLI::handleAdvancedCompare(const std::string& version1, const std::string&
                         cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(255, 255, 255), 2);
         }
         
+        if (!roi.empty()) {
+            info << "Restricting the comparison to " << roi.width << "x" << roi.height
+                 << " at (" << roi.x << ", " << roi.y << ")." << std::endl;
+        }
+        
+        // Optionally register the second version onto the first before hashing
+        bool wasAligned = false;
+        if (align) {
+            auto alignStart = std::chrono::high_resolution_clock::now();
+            cv::Mat aligned;
+            AlignmentResult alignment = ImageAligner::align(image1, image2, aligned, model);
+            auto alignMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - alignStart).count();
+            
+            if (alignment.aligned) {
+                image2 = aligned;
+                wasAligned = true;
+                info << "Aligned version " << v2 << " onto version " << v1 << " using "
+                     << alignment.inliers << " of " << alignment.matches << " feature matches in "
+                     << alignMs << "ms (largest shift " << std::fixed << std::setprecision(1)
+                     << alignment.shift << "px" << std::defaultfloat
+                     << (alignment.exact ? ", whole pixels" : "") << ")." << std::endl;
+            } else {
+                info << "Warning: Could not align the versions (" << alignment.matches
+                     << " feature matches); comparing them as stored." << std::endl;
+            }
+        }
+        
         // Time the advanced comparison
         auto startTime = std::chrono::high_resolution_clock::now();
-        std::vector<cv::Rect> diffRegions = ImageComparer::compareWithStructures(image1, image2, chunkSize, sensitivity);
+        LeafComparisonStats leafStats;
+        std::vector<cv::Rect> diffRegions;
+        {
+            AllocProfiler::Scope stage(AllocStage::Compare);
+            Progress progress(&commandToken, printProgress);
+            diffRegions = ImageComparer::compareWithStructures(image1, image2, chunkSize, sensitivity, &leafStats, roi,
+                                                               &progress);
+        }
         auto endTime = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
         
-        // Prepare result image with highlighted differences
-        cv::Mat resultImage = image1.clone();
+        std::string renderPath = output.renderPath.empty() ? "adv_differences_output.jpg" : output.renderPath;
         
-        for (const auto& region : diffRegions) {
-            // Ensure region is within image bounds
-            cv::Rect safeRegion = region & cv::Rect(0, 0, resultImage.cols, resultImage.rows);
-            if (safeRegion.width <= 0 || safeRegion.height <= 0) continue;
-            
-            // Create a semi-transparent red overlay
-            cv::Mat overlay = resultImage(safeRegion).clone();
-            cv::addWeighted(overlay, 0.5, cv::Scalar(0, 0, 255), 0.5, 0, overlay);
-            overlay.copyTo(resultImage(safeRegion));
-            
-            // Draw a green border
-            cv::rectangle(resultImage, safeRegion, cv::Scalar(0, 255, 0), 2);
+        // Structured report: score the regions instead of rendering them
+        if (!output.reportPath.empty()) {
+            DiffReport report;
+            report.method = "advcompare";
+            report.version1 = v1;
+            report.version2 = v2;
+            report.sensitivity = sensitivity;
+            report.chunkSize = chunkSize;
+            report.aligned = wasAligned;
+            report.imageSize = image1.size();
+            report.area = roi.empty() ? cv::Rect(0, 0, image1.cols, image1.rows) : roi;
+            report.regions = ImageComparer::scoreRegions(image1, image2, diffRegions, ImageComparer::PIXEL_THRESHOLD);
+            report.changedArea = DiffReportWriter::coveredFraction(report.regions, report.area);
+            report.hasLeafStats = true;
+            report.leafStats = leafStats;
+            report.elapsedMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+            DiffReportWriter::write(report, output.format, output.reportPath);
         }
         
-        // Save the result
-        cv::imwrite("adv_differences_output.jpg", resultImage);
+        // Highlight the differences on the first version, unless only a report was requested
+        if (output.render) {
+            ImageComparer::highlightDifferences(image1, diffRegions, renderPath);
+        }
         
-        std::cout << "Advanced comparison with chunk size: " << chunkSize 
-                  << " and sensitivity: " << sensitivity 
-                  << " (higher = more tolerant)" << std::endl;
-        std::cout << "Found " << diffRegions.size() << " differing regions in " 
-                  << duration.count() << "ms." << std::endl;
-        std::cout << "Advanced differences highlighted and saved to adv_differences_output.jpg" << std::endl;
+        info << "Advanced comparison with chunk size: " << chunkSize 
+             << " and sensitivity: " << sensitivity 
+             << " (higher = more tolerant)" << std::endl;
+        info << "Found " << diffRegions.size() << " differing regions in " 
+             << duration.count() << "ms." << std::endl;
+        info << "Leaves resolved by checksum: " << leafStats.checksumMatches
+             << ", fast hash: " << leafStats.fastHashMatches
+             << ", perceptual hash: " << leafStats.perceptualMatches
+             << ", refined at pixel level: " << leafStats.mismatches << std::endl;
+        if (leafStats.kernelHashes > 0) {
+            info << "Compile-time leaf kernels computed " << leafStats.kernelHashes << " of "
+                 << leafStats.tileHashes << " tile hashes." << std::endl;
+        }
+        if (!output.reportPath.empty() && output.reportPath != "-") {
+            info << "Report saved to " << output.reportPath << std::endl;
+        }
+        if (output.render) {
+            info << "Advanced differences highlighted and saved to " << renderPath << std::endl;
+        }
+    }
+    catch (const OperationCancelled&) {
+        std::cerr << "\nComparison cancelled.\n";
     }
     catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
 }
 
+// Finds the stored versions most similar to an image on disk
+void CLI::handleFind(const std::string& args) {
+    try {
+        // "<image> [k]"; the path may contain spaces, so k is only taken from a trailing number
+        std::string filePath = args;
+        size_t k = 5;
+        size_t lastSpace = args.find_last_of(' ');
+        if (lastSpace != std::string::npos && lastSpace + 1 < args.size()) {
+            std::string tail = args.substr(lastSpace + 1);
+            if (std::all_of(tail.begin(), tail.end(), [](unsigned char c) { return std::isdigit(c); })) {
+                k = std::max(1, std::stoi(tail));
+                filePath = args.substr(0, lastSpace);
+            }
+        }
+        
+        auto versions = repository.snapshot();
+        if (versions->empty()) {
+            throw std::runtime_error("No versions in the repository.");
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        // Root hash and global perceptual hash of the query, computed once
+        cv::Mat image = ImageProcessor::readImage(filePath);
+        if (image.cols < 16 || image.rows < 16) {
+            throw std::runtime_error("Image dimensions are too small for Quadtree processing (minimum 16x16).");
+        }
+        std::string rootHash = LeafHasher::buildRecord(image, 16).rootHash();
+        uint64_t globalHash = LeafHasher::globalHash(image);
+        
+        // Bring the index in line with the repository (versions added before the index existed).
+        // Missing signatures are computed first; the index is then reloaded, extended and saved
+        // under the repository lock, so entries added or removed meanwhile are not overwritten.
+        SimilarityIndex index;
+        index.load();
+        std::map<int, std::pair<VersionSignature, bool>> missing; // Signature, and whether it was rebuilt
+        for (const auto& pair : *versions) {
+            if (index.contains(pair.first)) continue;
+            VersionSignature signature;
+            bool rebuilt = false;
+            if (!HashStore::loadSignature(pair.first, signature)) {
+                cv::Mat stored = cv::imread(Repository::snapshotPath(pair.first), cv::IMREAD_UNCHANGED);
+                if (stored.empty()) continue;
+                signature = LeafHasher::buildSignature(stored);
+                rebuilt = true;
+            }
+            missing.emplace(pair.first, std::make_pair(std::move(signature), rebuilt));
+        }
+        if (!missing.empty()) {
+            repository.locked([&](const Repository::VersionMap& current) {
+                index = SimilarityIndex();
+                index.load();
+                bool changed = false;
+                for (const auto& entry : missing) {
+                    auto stored = current.find(entry.first);
+                    if (stored == current.end() || index.contains(entry.first)) continue;
+                    if (entry.second.second) {
+                        HashStore::saveSignature(entry.first, entry.second.first);
+                    }
+                    index.insert(entry.first, stored->second, entry.second.first.globalHash);
+                    changed = true;
+                }
+                if (changed) {
+                    index.save();
+                }
+            });
+        }
+        
+        std::vector<int> exact = index.findExact(rootHash);
+        std::vector<SimilarityIndex::Match> nearest = index.findNearest(globalHash, k);
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+        
+        if (!exact.empty()) {
+            std::cout << "Exact match (same root hash): version";
+            for (int v : exact) std::cout << " " << v;
+            std::cout << "\n";
+        } else {
+            std::cout << "No version has the same root hash.\n";
+        }
+        
+        std::cout << "Most similar versions:\n";
+        std::cout << "Version | Distance (bits of 64)\n";
+        for (const auto& match : nearest) {
+            std::cout << match.version << " | " << match.distance << "\n";
+        }
+        std::cout << "Search over " << index.size() << " versions took " << duration.count() << "ms.\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Parses "<from>-<to>" into an inclusive version range
+static bool parseVersionRange(const std::string& text, int& from, int& to) {
+    size_t dash = text.find('-');
+    if (dash == std::string::npos || dash == 0 || dash == text.size() - 1) {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); i++) {
+        if (i != dash && !std::isdigit(static_cast<unsigned char>(text[i]))) {
+            return false;
+        }
+    }
+    from = std::stoi(text.substr(0, dash));
+    to = std::stoi(text.substr(dash + 1));
+    return from <= to;
+}
+
+// Pairwise similarity of every version in a range, from the stored signatures
+void CLI::handleMatrix(const std::string& args) {
+    try {
+        std::istringstream iss(args);
+        std::string rangeArg, outputPath = "similarity_matrix.csv";
+        int from = std::numeric_limits<int>::min();
+        int to = std::numeric_limits<int>::max();
+        
+        if (iss >> rangeArg) {
+            if (rangeArg != "all" && !parseVersionRange(rangeArg, from, to)) {
+                throw std::invalid_argument("Invalid range. Use: matrix [<from>-<to>|all] [output.csv|output.bin]");
+            }
+            iss >> outputPath;
+        }
+        
+        auto snapshot = repository.snapshot();
+        std::vector<int> versions;
+        for (const auto& pair : *snapshot) {
+            if (pair.first >= from && pair.first <= to) {
+                versions.push_back(pair.first);
+            }
+        }
+        if (versions.size() < 2) {
+            throw std::runtime_error("Need at least two versions in the range.");
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        // Load signatures; versions added before signatures existed are computed once and stored
+        std::vector<VersionSignature> signatures(versions.size());
+        std::vector<char> available(versions.size(), 0);
+        cv::parallel_for_(cv::Range(0, static_cast<int>(versions.size())), [&](const cv::Range& range) {
+            for (int i = range.start; i < range.end; i++) {
+                if (HashStore::loadSignature(versions[i], signatures[i])) {
+                    available[i] = 1;
+                    continue;
+                }
+                cv::Mat image = cv::imread(Repository::snapshotPath(versions[i]), cv::IMREAD_UNCHANGED);
+                if (image.empty()) continue;
+                try {
+                    signatures[i] = LeafHasher::buildSignature(image);
+                    HashStore::saveSignature(versions[i], signatures[i]);
+                    available[i] = 1;
+                } catch (const std::exception&) {
+                }
+            }
+        });
+        
+        std::vector<int> included;
+        std::vector<VersionSignature> includedSignatures;
+        for (size_t i = 0; i < versions.size(); i++) {
+            if (available[i]) {
+                included.push_back(versions[i]);
+                includedSignatures.push_back(std::move(signatures[i]));
+            } else {
+                std::cout << "Warning: No signature or image for version " << versions[i] << "; skipped.\n";
+            }
+        }
+        if (included.size() < 2) {
+            throw std::runtime_error("Not enough versions with signatures to build a matrix.");
+        }
+        
+        cv::Mat matrix = ImageComparer::similarityMatrix(includedSignatures);
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+        
+        // Write CSV, or a binary matrix when the path ends in .bin:
+        // "VSIM", int32 n, n int32 version numbers, n*n float32 row-major
+        const int n = static_cast<int>(included.size());
+        bool binary = outputPath.size() > 4 && outputPath.compare(outputPath.size() - 4, 4, ".bin") == 0;
+        if (binary) {
+            std::ofstream out(outputPath, std::ios::binary);
+            if (!out.is_open()) throw std::runtime_error("Could not open file for writing: " + outputPath);
+            out.write("VSIM", 4);
+            out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+            out.write(reinterpret_cast<const char*>(included.data()), sizeof(int) * n);
+            for (int i = 0; i < n; i++) {
+                out.write(reinterpret_cast<const char*>(matrix.ptr<float>(i)), sizeof(float) * n);
+            }
+        } else {
+            std::ofstream out(outputPath);
+            if (!out.is_open()) throw std::runtime_error("Could not open file for writing: " + outputPath);
+            out << "version";
+            for (int v : included) out << "," << v;
+            out << "\n" << std::fixed << std::setprecision(4);
+            for (int i = 0; i < n; i++) {
+                out << included[i];
+                for (int j = 0; j < n; j++) out << "," << matrix.at<float>(i, j);
+                out << "\n";
+            }
+        }
+        
+        // Summarise near-duplicates and the largest jumps between consecutive versions
+        const float duplicateThreshold = 0.95f;
+        size_t duplicates = 0;
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                if (matrix.at<float>(i, j) >= duplicateThreshold) duplicates++;
+            }
+        }
+        
+        std::vector<std::pair<float, int>> jumps;
+        for (int i = 0; i + 1 < n; i++) {
+            jumps.push_back({matrix.at<float>(i, i + 1), i});
+        }
+        std::sort(jumps.begin(), jumps.end());
+        
+        std::cout << "Similarity matrix for " << n << " versions (" << (static_cast<size_t>(n) * (n - 1) / 2)
+                  << " pairs) computed in " << duration.count() << "ms.\n";
+        std::cout << "Near-duplicate pairs (similarity >= " << duplicateThreshold << "): " << duplicates << "\n";
+        std::cout << "Largest jumps between consecutive versions:\n";
+        for (size_t k = 0; k < jumps.size() && k < 5; k++) {
+            int i = jumps[k].second;
+            std::cout << "  " << included[i] << " -> " << included[i + 1]
+                      << "  similarity " << std::fixed << std::setprecision(3) << jumps[k].first << "\n";
+        }
+        std::cout << std::defaultfloat;
+        std::cout << "Matrix saved to " << outputPath << "\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Version history from the stored per-tile records; with `stat`, each version is diffed
+// against the previous one by leaf checksum, so no image is decoded
+void CLI::handleLog(bool stat) {
+    try {
+        auto versions = repository.snapshot();
+        if (versions->empty()) {
+            std::cout << "No versions in the repository.\n";
+            return;
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        VersionHashes previous;
+        bool havePrevious = false;
+        int previousVersion = 0;
+        size_t pairs = 0;
+        
+        for (const auto& pair : *versions) {
+            VersionHashes record;
+            bool haveRecord = HashStore::load(pair.first, record);
+            
+            std::cout << "Version " << pair.first << "  " << pair.second.substr(0, 16);
+            if (haveRecord) {
+                std::cout << "  " << record.imageSize.width << "x" << record.imageSize.height
+                          << ", " << record.checksums.size() << " tiles\n";
+            } else {
+                std::cout << "  (no stored hashes)\n";
+            }
+            
+            if (stat && havePrevious && haveRecord) {
+                std::cout << "    vs " << previousVersion << ": ";
+                if (record.imageSize != previous.imageSize || record.minSize != previous.minSize) {
+                    std::cout << "size changed from " << previous.imageSize.width << "x" << previous.imageSize.height
+                              << " to " << record.imageSize.width << "x" << record.imageSize.height << "\n";
+                } else if (record.rootHash() == previous.rootHash() && record.checksums == previous.checksums) {
+                    std::cout << "no changes\n";
+                } else {
+                    // Same size and tile size means the same leaf layout, so tiles line up by index
+                    std::vector<cv::Rect> changed;
+                    long long changedArea = 0;
+                    for (size_t i = 0; i < record.checksums.size(); i++) {
+                        if (record.checksums[i] != previous.checksums[i]) {
+                            changed.push_back(record.regions[i]);
+                            changedArea += record.regions[i].area();
+                        }
+                    }
+                    
+                    // Touching tiles form one changed area
+                    std::vector<cv::Rect> areas = ImageComparer::mergeRegions(changed, 1);
+                    double percent = 100.0 * changedArea / record.imageSize.area();
+                    
+                    std::cout << changed.size() << " of " << record.checksums.size() << " tiles changed ("
+                              << std::fixed << std::setprecision(1) << percent << "% of the image)"
+                              << std::defaultfloat << ", " << areas.size() << " area(s)\n";
+                    for (size_t k = 0; k < areas.size() && k < 5; k++) {
+                        const cv::Rect& r = areas[k];
+                        std::cout << "      at (" << r.x << ", " << r.y << ") size " << r.width << "x" << r.height << "\n";
+                    }
+                    if (areas.size() > 5) {
+                        std::cout << "      ... and " << (areas.size() - 5) << " more\n";
+                    }
+                }
+                pairs++;
+            } else if (stat && havePrevious && !haveRecord) {
+                std::cout << "    vs " << previousVersion << ": not available\n";
+            }
+            
+            if (haveRecord) {
+                previous = std::move(record);
+                previousVersion = pair.first;
+                havePrevious = true;
+            } else {
+                havePrevious = false;
+            }
+        }
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+        
+        if (stat) {
+            std::cout << "Compared " << pairs << " pairs of versions in " << duration.count() << "ms.\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Binary-searches the versions between good and bad for the first one whose leaves covering
+// the region differ from good's. Only the stored leaf checksums are read, so no image is
+// decoded unless a version has no stored hashes.
+void CLI::handleBisect(const std::string& args) {
+    try {
+        std::istringstream iss(args);
+        std::string regionArg;
+        int good = 0;
+        int bad = 0;
+        cv::Rect region;
+        if (!(iss >> regionArg >> good >> bad) || !parseRect(regionArg, region)) {
+            throw std::invalid_argument("Use: bisect <x,y,w,h> <good> <bad>");
+        }
+        if (good >= bad) {
+            throw std::invalid_argument("The good version must be older than the bad version.");
+        }
+        if (!repository.contains(good) || !repository.contains(bad)) {
+            throw std::runtime_error("One or both versions do not exist.");
+        }
+        
+        // Versions in the range, oldest first; deleted numbers are simply absent
+        auto versions = repository.snapshot();
+        std::vector<int> range;
+        for (auto it = versions->lower_bound(good); it != versions->end() && it->first <= bad; ++it) {
+            range.push_back(it->first);
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        size_t lookups = 0;
+        size_t decoded = 0;
+        
+        // Leaves of one version overlapping the region; hashes are rebuilt and stored
+        // for versions that predate the hash store
+        auto loadTiles = [&](int version) {
+            VersionHashes record;
+            bool rebuilt = false;
+            if (!loadOrBuildRecord(repository, version, record, rebuilt)) {
+                throw std::runtime_error("No stored hashes or image for version " + std::to_string(version) + ".");
+            }
+            if (rebuilt) decoded++;
+            lookups++;
+            
+            RegionTiles tiles;
+            tiles.imageSize = record.imageSize;
+            tiles.minSize = record.minSize;
+            for (size_t i = 0; i < record.regions.size(); i++) {
+                if ((record.regions[i] & region).area() > 0) {
+                    tiles.regions.push_back(record.regions[i]);
+                    tiles.checksums.push_back(record.checksums[i]);
+                }
+            }
+            return tiles;
+        };
+        
+        RegionTiles goodTiles = loadTiles(good);
+        if (goodTiles.regions.empty()) {
+            throw std::runtime_error("The region lies outside version " + std::to_string(good) + "'s image.");
+        }
+        RegionTiles badTiles = loadTiles(bad);
+        if (badTiles.sameAs(goodTiles)) {
+            std::cout << "The region is the same in versions " << good << " and " << bad << "; nothing to bisect.\n";
+            return;
+        }
+        
+        // Invariant: range[low] matches good, range[high] does not
+        size_t low = 0;
+        size_t high = range.size() - 1;
+        RegionTiles lowTiles = goodTiles;
+        RegionTiles highTiles = badTiles;
+        while (high - low > 1) {
+            size_t mid = low + (high - low) / 2;
+            RegionTiles midTiles = loadTiles(range[mid]);
+            std::cout << "Version " << range[mid] << ": " << (midTiles.sameAs(goodTiles) ? "good" : "bad") << "\n";
+            if (midTiles.sameAs(goodTiles)) {
+                low = mid;
+                lowTiles = std::move(midTiles);
+            } else {
+                high = mid;
+                highTiles = std::move(midTiles);
+            }
+        }
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+        
+        std::cout << "First version where the region changed: " << range[high]
+                  << " (previous: " << range[low] << ")\n";
+        if (highTiles.imageSize != lowTiles.imageSize || highTiles.minSize != lowTiles.minSize) {
+            std::cout << "  The image size changed from " << lowTiles.imageSize.width << "x" << lowTiles.imageSize.height
+                      << " to " << highTiles.imageSize.width << "x" << highTiles.imageSize.height << ".\n";
+        } else {
+            std::vector<cv::Rect> changed;
+            for (size_t i = 0; i < highTiles.checksums.size(); i++) {
+                if (highTiles.checksums[i] != lowTiles.checksums[i]) {
+                    changed.push_back(highTiles.regions[i]);
+                }
+            }
+            for (const auto& r : ImageComparer::mergeRegions(changed, 1)) {
+                std::cout << "  Changed tiles at (" << r.x << ", " << r.y << ") size " << r.width << "x" << r.height << "\n";
+            }
+        }
+        std::cout << "Checked " << lookups << " of " << range.size() << " versions in " << duration.count() << "ms";
+        if (decoded > 0) {
+            std::cout << " (" << decoded << " without stored hashes were decoded and hashed)";
+        }
+        std::cout << ".\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Answers "which version last changed this tile?" from the blame index, one lookup per
+// queried tile. The index is rebuilt from the stored hashes when it does not cover every version.
+void CLI::handleBlame(const std::string& args) {
+    try {
+        std::string rest = args;
+        std::string renderPath;
+        bool render = extractOption(rest, "render", renderPath);
+        if (renderPath.empty()) renderPath = "blame_output.jpg";
+        
+        int version = repository.currentVersion();
+        cv::Rect area;
+        std::istringstream iss(rest);
+        std::string token;
+        while (iss >> token) {
+            if (token.find(',') != std::string::npos) {
+                if (!parseRect(token, area)) {
+                    throw std::invalid_argument("Invalid region. Use: x,y,width,height");
+                }
+            } else {
+                for (char c : token) {
+                    if (!std::isdigit(c)) {
+                        throw std::invalid_argument("Use: blame [version] [x,y,w,h] [--render [path]]");
+                    }
+                }
+                version = std::stoi(token);
+            }
+        }
+        if (!repository.contains(version)) {
+            throw std::runtime_error("Version " + std::to_string(version) + " does not exist.");
+        }
+        
+        // Versions with neither stored hashes nor a snapshot can never be indexed, so they do
+        // not count as missing
+        auto versions = repository.snapshot();
+        BlameIndex index;
+        bool covered = index.load();
+        for (auto it = versions->begin(); covered && it != versions->end(); ++it) {
+            covered = index.contains(it->first) ||
+                      (!Utils::fileExists(HashStore::pathFor(it->first)) &&
+                       !Utils::fileExists(Repository::snapshotPath(it->first)));
+        }
+        if (!covered) {
+            // Built under the repository lock from the versions on disk, so a concurrent add or
+            // delete is neither lost from the saved index nor given a stale hash record
+            std::cout << "Building the blame index from stored hashes...\n";
+            repository.locked([&](const Repository::VersionMap& current) {
+                index = BlameIndex();
+                for (const auto& pair : current) {
+                    VersionHashes record;
+                    bool rebuilt = false;
+                    if (!loadOrBuildRecord(repository, pair.first, record, rebuilt)) {
+                        std::cout << "Warning: No stored hashes or image for version " << pair.first << "; skipped.\n";
+                        continue;
+                    }
+                    index.update(pair.first, record);
+                }
+                index.save();
+            });
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        std::vector<BlameIndex::TileBlame> tiles = index.blame(version, area);
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - startTime);
+        
+        // Tiles and area last changed by each version
+        std::map<int, std::pair<size_t, long long>> byVersion;
+        long long totalArea = 0;
+        for (const auto& tile : tiles) {
+            auto& entry = byVersion[tile.version];
+            entry.first++;
+            entry.second += tile.region.area();
+            totalArea += tile.region.area();
+        }
+        
+        std::cout << "Blame for version " << version << ": " << tiles.size() << " tiles";
+        if (!area.empty()) {
+            std::cout << " overlapping (" << area.x << ", " << area.y << ") size " << area.width << "x" << area.height;
+        }
+        std::cout << "\n";
+        
+        // List every tile for a region; the whole image is summarised per version
+        if (!area.empty()) {
+            for (const auto& tile : tiles) {
+                const cv::Rect& r = tile.region;
+                std::cout << "  (" << r.x << ", " << r.y << ") " << r.width << "x" << r.height
+                          << "  version " << tile.version << "\n";
+            }
+        }
+        for (auto it = byVersion.rbegin(); it != byVersion.rend(); ++it) {
+            double percent = totalArea > 0 ? 100.0 * it->second.second / totalArea : 0.0;
+            std::cout << "  Version " << it->first << ": " << it->second.first << " tiles ("
+                      << std::fixed << std::setprecision(1) << percent << "%)" << std::defaultfloat << "\n";
+        }
+        std::cout << "Answered in " << duration.count() << "us.\n";
+        
+        if (render) {
+            cv::Mat image = cv::imread(Repository::snapshotPath(version));
+            if (image.empty()) {
+                throw std::runtime_error("Could not load the image of version " + std::to_string(version) + ".");
+            }
+            
+            // Colour each tile by the age of its last change: oldest blue, newest red
+            cv::Mat gradient(1, 256, CV_8UC1);
+            for (int i = 0; i < 256; i++) gradient.at<uchar>(0, i) = static_cast<uchar>(i);
+            cv::Mat palette;
+            cv::applyColorMap(gradient, palette, cv::COLORMAP_JET);
+            
+            std::vector<int> ages;
+            for (const auto& pair : byVersion) ages.push_back(pair.first);
+            
+            for (const auto& tile : tiles) {
+                cv::Rect r = tile.region & cv::Rect(0, 0, image.cols, image.rows);
+                if (r.empty()) continue;
+                size_t rank = std::lower_bound(ages.begin(), ages.end(), tile.version) - ages.begin();
+                int shade = ages.size() > 1 ? static_cast<int>(255 * rank / (ages.size() - 1)) : 255;
+                cv::Vec3b colour = palette.at<cv::Vec3b>(0, shade);
+                
+                cv::Mat target = image(r);
+                cv::addWeighted(target, 0.55, cv::Scalar(colour[0], colour[1], colour[2]), 0.45, 0, target);
+                cv::rectangle(image, r, cv::Scalar(255, 255, 255), 1);
+                if (r.width >= 32 && r.height >= 16) {
+                    cv::putText(image, std::to_string(tile.version), cv::Point(r.x + 3, r.y + 13),
+                                cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 255, 255), 1);
+                }
+            }
+            
+            cv::imwrite(renderPath, image);
+            std::cout << "Age map saved to " << renderPath << "\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Three-way merge: tiles are classified from the stored leaf checksums, and only the tiles
+// taken from their side are copied into our image. Conflicts are reported unless a side
+// was chosen for them.
+void CLI::handleMerge(const std::string& args) {
+    try {
+        std::istringstream iss(args);
+        std::string baseArg, oursArg, theirsArg, option;
+        if (!(iss >> baseArg >> oursArg >> theirsArg)) {
+            throw std::invalid_argument("Use: merge <base> <ours> <theirs> [--ours|--theirs]");
+        }
+        bool resolve = false;
+        bool takeTheirs = false;
+        if (iss >> option) {
+            if (option != "--ours" && option != "--theirs") {
+                throw std::invalid_argument("Use: merge <base> <ours> <theirs> [--ours|--theirs]");
+            }
+            resolve = true;
+            takeTheirs = option == "--theirs";
+        }
+        for (const std::string* arg : {&baseArg, &oursArg, &theirsArg}) {
+            for (char c : *arg) {
+                if (!std::isdigit(c)) {
+                    throw std::invalid_argument("Version numbers must be integers");
+                }
+            }
+        }
+        int base = std::stoi(baseArg);
+        int ours = std::stoi(oursArg);
+        int theirs = std::stoi(theirsArg);
+        if (!repository.contains(base) || !repository.contains(ours) || !repository.contains(theirs)) {
+            throw std::runtime_error("One or more versions do not exist.");
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        VersionHashes baseRecord, oursRecord, theirsRecord;
+        bool rebuilt = false;
+        if (!loadOrBuildRecord(repository, base, baseRecord, rebuilt) ||
+            !loadOrBuildRecord(repository, ours, oursRecord, rebuilt) ||
+            !loadOrBuildRecord(repository, theirs, theirsRecord, rebuilt)) {
+            throw std::runtime_error("No stored hashes or image for one of the versions.");
+        }
+        
+        MergePlan plan = TileMerge::plan(baseRecord, oursRecord, theirsRecord);
+        std::cout << "Merging version " << theirs << " into version " << ours << " (base " << base << "): "
+                  << plan.sources.size() << " tiles\n";
+        std::cout << "  unchanged: " << plan.unchanged << ", ours only: " << plan.ours
+                  << ", theirs only: " << plan.theirs << ", same on both: " << plan.both
+                  << ", conflicting: " << plan.conflicts << "\n";
+        
+        if (plan.conflicts > 0) {
+            std::vector<cv::Rect> conflicts = TileMerge::conflictRegions(plan, oursRecord);
+            std::cout << "Conflicting regions:\n";
+            for (size_t k = 0; k < conflicts.size() && k < 10; k++) {
+                const cv::Rect& r = conflicts[k];
+                std::cout << "  at (" << r.x << ", " << r.y << ") size " << r.width << "x" << r.height << "\n";
+            }
+            if (conflicts.size() > 10) {
+                std::cout << "  ... and " << (conflicts.size() - 10) << " more\n";
+            }
+            if (!resolve) {
+                std::cout << "No version created. Rerun with --ours or --theirs to choose a side for the conflicts.\n";
+                return;
+            }
+            std::cout << "Conflicts resolved with " << (takeTheirs ? "their" : "our") << " tiles.\n";
+        }
+        
+        bool anyFromTheirs = plan.theirs > 0 || (plan.conflicts > 0 && takeTheirs);
+        if (!anyFromTheirs) {
+            std::cout << "Version " << ours << " already contains the result; no version created.\n";
+            return;
+        }
+        
+        // Pixels are only needed now: our image is the canvas, their tiles are copied in
+        std::string oursPath = Repository::snapshotPath(ours);
+        std::string theirsPath = Repository::snapshotPath(theirs);
+        cv::Mat merged = cv::imread(oursPath, cv::IMREAD_UNCHANGED);
+        cv::Mat theirsImage = cv::imread(theirsPath, cv::IMREAD_UNCHANGED);
+        if (merged.empty() || theirsImage.empty()) {
+            throw std::runtime_error("Could not load the saved images.");
+        }
+        TileMerge::assemble(plan, oursRecord, theirsImage, takeTheirs, merged);
+        
+        // Lossy legacy snapshots no longer match their recorded checksums, so their tiles are rehashed
+        VersionHashes record;
+        if (Repository::isLegacySnapshot(oursPath) || Repository::isLegacySnapshot(theirsPath)) {
+            record = LeafHasher::buildRecordIncremental(merged, oursRecord.minSize, oursRecord);
+        } else {
+            record = TileMerge::mergedRecord(plan, oursRecord, theirsRecord, takeTheirs);
+        }
+        
+        std::vector<uchar> encoded;
+        if (!cv::imencode(".png", merged, encoded)) {
+            throw std::runtime_error("Could not encode the merged image.");
+        }
+        VersionSignature signature = LeafHasher::buildSignature(merged);
+        EncodedPyramid pyramid = PyramidStore::build(merged);
+        int version = storeVersion(record, encoded, signature, pyramid);
+        
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - startTime);
+        std::cout << "Merged version " << version << " created in " << duration.count() << "ms. Root hash: "
+                  << record.rootHash() << "\n";
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    } catch (const std::out_of_range& e) {
+        std::cerr << "Error: Version number out of range\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Writes the versions another repository directory lacks into one bundle file. Both sides
+// are indexed by content root; each missing version is sent as the leaves that differ from
+// the nearest earlier version the destination will have, or whole when that is no smaller.
+void CLI::handleBundleCreate(const std::string& destination, const std::string& bundlePath) {
+    try {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Progress progress(&commandToken, printProgress);
+
+        // Read only: the destination is not locked or written until the bundle is applied there
+        if (!Utils::directoryExists(destination)) {
+            throw std::runtime_error("Destination directory " + destination + " does not exist.");
+        }
+        Repository::VersionMap targetVersions;
+        if (!Repository::readVersions(destination + "/version_repository.dat", targetVersions)) {
+            std::cout << "Destination has no repository yet; every version will be bundled.\n";
+        }
+        std::set<std::string> available;
+        progress.begin("Indexing destination", targetVersions.size(), "versions");
+        for (const auto& pair : targetVersions) {
+            VersionHashes record;
+            if (Bundle::loadContentRecord(destination, pair.first, record)) {
+                available.insert(Bundle::checksumTree(record).getRootHash());
+            }
+            progress.step();
+        }
+        progress.finish();
+
+        auto versions = repository.snapshot();
+        Bundle::Writer writer(bundlePath);
+        size_t wholeCount = 0, deltaCount = 0, presentCount = 0, tilesSent = 0;
+        uint64_t bytesSent = 0;
+
+        // The latest version the destination has or will have once the bundle is applied
+        VersionHashes previous;
+        std::unique_ptr<MerkleTree> previousTree;
+        std::string previousRoot;
+
+        progress.begin("Packing versions", versions->size(), "versions");
+        for (const auto& pair : *versions) {
+            VersionHashes record;
+            if (!Bundle::loadContentRecord("", pair.first, record)) {
+                std::cerr << "Warning: No stored hashes or image for version " << pair.first << "; not bundled.\n";
+                progress.step();
+                continue;
+            }
+            std::unique_ptr<MerkleTree> tree(new MerkleTree(Bundle::checksumTree(record)));
+            std::string root = tree->getRootHash();
+
+            if (available.count(root) == 0) {
+                std::string path = Repository::snapshotPath(pair.first);
+                cv::Mat image = cv::imread(path, cv::IMREAD_UNCHANGED);
+                if (image.empty()) {
+                    throw std::runtime_error("Could not load the snapshot of version " + std::to_string(pair.first) + ".");
+                }
+
+                // New snapshots are sent as stored; legacy JPEGs are re-encoded losslessly
+                std::vector<uchar> png;
+                if (Repository::isLegacySnapshot(path)) {
+                    if (!cv::imencode(".png", image, png)) {
+                        throw std::runtime_error("Could not encode version " + std::to_string(pair.first) + ".");
+                    }
+                } else {
+                    std::ifstream file(path, std::ios::binary);
+                    png.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                }
+
+                BundleEntry entry;
+                entry.contentRoot = root;
+                entry.imageSize = record.imageSize;
+                entry.minSize = record.minSize;
+                entry.type = image.type();
+
+                // Checksums cover the tile type, so a base of another type differs in every leaf
+                if (previousTree && previous.imageSize == record.imageSize && previous.minSize == record.minSize) {
+                    std::vector<size_t> differing = previousTree->differingLeaves(*tree);
+                    if (differing.size() < record.checksums.size()) {
+                        std::vector<uint32_t> tiles(differing.begin(), differing.end());
+                        std::vector<uchar> packed = Bundle::packTiles(image, record.regions, tiles);
+                        if (packed.size() < png.size()) {
+                            entry.baseRoot = previousRoot;
+                            entry.data = std::move(packed);
+                            for (uint32_t tile : tiles) {
+                                entry.checksums.push_back(record.checksums[tile]);
+                            }
+                            entry.tiles = std::move(tiles);
+                        }
+                    }
+                }
+                if (entry.baseRoot.empty()) {
+                    entry.data = std::move(png);
+                    wholeCount++;
+                } else {
+                    tilesSent += entry.tiles.size();
+                    deltaCount++;
+                }
+                bytesSent += entry.data.size() + entry.checksums.size() * sizeof(uint64_t);
+                writer.write(entry);
+                available.insert(root);
+            } else {
+                presentCount++;
+            }
+
+            previous = std::move(record);
+            previousTree = std::move(tree);
+            previousRoot = root;
+            progress.step();
+        }
+        progress.finish();
+        writer.close();
+
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - startTime);
+        std::cout << "Bundle written to " << bundlePath << " in " << duration.count() << "ms: "
+                  << (wholeCount + deltaCount) << " versions (" << wholeCount << " whole, " << deltaCount
+                  << " as " << tilesSent << " changed tiles), " << bytesSent << " bytes of image data and checksums.\n";
+        std::cout << presentCount << " versions are already in " << destination << ".\n";
+    } catch (const OperationCancelled&) {
+        std::cerr << "\nCancelled; no bundle was written.\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Adds the versions of a bundle that this repository lacks. Delta entries are rebuilt on
+// top of their base snapshot, and every image is checked against the bundled checksums and
+// content root before it is stored.
+void CLI::handleBundleApply(const std::string& bundlePath) {
+    try {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Progress progress(&commandToken, printProgress);
+        Bundle::Reader reader(bundlePath);
+
+        auto versions = repository.snapshot();
+        std::map<std::string, int> present;
+        progress.begin("Indexing repository", versions->size(), "versions");
+        for (const auto& pair : *versions) {
+            VersionHashes record;
+            if (Bundle::loadContentRecord("", pair.first, record)) {
+                present.emplace(Bundle::checksumTree(record).getRootHash(), pair.first);
+            }
+            progress.step();
+        }
+        progress.finish();
+
+        size_t added = 0, skipped = 0;
+        BundleEntry entry;
+        while (reader.next(entry)) {
+            progress.throwIfCancelled();
+            if (present.count(entry.contentRoot)) {
+                skipped++;
+                continue;
+            }
+
+            cv::Mat image;
+            VersionHashes baseRecord;
+            bool delta = !entry.baseRoot.empty();
+            if (delta) {
+                auto base = present.find(entry.baseRoot);
+                if (base == present.end()) {
+                    throw std::runtime_error("The bundle needs a base version this repository does not have.");
+                }
+                image = cv::imread(Repository::snapshotPath(base->second), cv::IMREAD_UNCHANGED);
+                if (image.empty() || !Bundle::loadContentRecord("", base->second, baseRecord)) {
+                    throw std::runtime_error("Could not load base version " + std::to_string(base->second) + ".");
+                }
+                if (image.size() != entry.imageSize || image.type() != entry.type ||
+                    baseRecord.imageSize != entry.imageSize || baseRecord.minSize != entry.minSize) {
+                    throw std::runtime_error("Base version " + std::to_string(base->second) +
+                                             " does not match the bundled layout.");
+                }
+                Bundle::unpackTiles(entry.data, baseRecord.regions, entry.tiles, image);
+            } else {
+                image = cv::imdecode(entry.data, cv::IMREAD_UNCHANGED);
+                if (image.empty() || image.size() != entry.imageSize || image.type() != entry.type) {
+                    throw std::runtime_error("A bundled snapshot could not be decoded.");
+                }
+            }
+
+            // A delta's checksums are the base's with the carried leaves replaced; they must add
+            // up to the content root before the rebuilt pixels are checked against them
+            VersionHashes record;
+            if (delta) {
+                std::vector<uint64_t> expected = baseRecord.checksums;
+                for (size_t i = 0; i < entry.tiles.size(); i++) {
+                    expected[entry.tiles[i]] = entry.checksums[i];
+                }
+                VersionHashes expectedRecord;
+                expectedRecord.checksums = std::move(expected);
+                if (Bundle::checksumTree(expectedRecord).getRootHash() != entry.contentRoot) {
+                    throw std::runtime_error("A bundled version does not match its content root; the bundle is corrupt.");
+                }
+                record = LeafHasher::buildRecordIncremental(image, entry.minSize, baseRecord);
+                if (record.checksums != expectedRecord.checksums) {
+                    throw std::runtime_error("A bundled version does not match its checksums; the bundle is corrupt.");
+                }
+            } else {
+                record = LeafHasher::buildRecord(image, entry.minSize);
+                if (Bundle::checksumTree(record).getRootHash() != entry.contentRoot) {
+                    throw std::runtime_error("A bundled version does not match its content root; the bundle is corrupt.");
+                }
+            }
+
+            std::vector<uchar> encoded;
+            if (delta) {
+                if (!cv::imencode(".png", image, encoded)) {
+                    throw std::runtime_error("Could not encode the image.");
+                }
+            } else {
+                encoded = std::move(entry.data);
+            }
+            VersionSignature signature = LeafHasher::buildSignature(image);
+            EncodedPyramid pyramid = PyramidStore::build(image);
+            int version = storeVersion(record, encoded, signature, pyramid);
+            present.emplace(entry.contentRoot, version);
+            added++;
+        }
+
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - startTime);
+        std::cout << "Applied " << bundlePath << " in " << duration.count() << "ms: " << added
+                  << " versions added, " << skipped << " already present.\n";
+    } catch (const OperationCancelled&) {
+        std::cerr << "\nCancelled; versions added so far were kept.\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
+// Checks stored versions against their recorded root hashes, across all cores
+void CLI::handleVerify(const std::string& target) {
+    try {
+        auto snapshot = repository.snapshot();
+        std::vector<std::pair<int, std::string>> versions;
+        
+        // "verify " with nothing after it checks everything, like plain "verify"
+        std::string which;
+        std::istringstream(target) >> which;
+        
+        if (which.empty() || which == "all") {
+            versions.assign(snapshot->begin(), snapshot->end());
+        } else {
+            for (char c : which) {
+                if (!std::isdigit(c)) {
+                    throw std::invalid_argument("Use: verify [version|all]");
+                }
+            }
+            int v = std::stoi(which);
+            auto it = snapshot->find(v);
+            if (it == snapshot->end()) {
+                throw std::runtime_error("Version " + which + " does not exist.");
+            }
+            versions.push_back(*it);
+        }
+        
+        if (versions.empty()) {
+            std::cout << "No versions in the repository.\n";
+            return;
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        std::vector<VerificationResult> results(versions.size());
+        cv::parallel_for_(cv::Range(0, static_cast<int>(versions.size())), [&](const cv::Range& range) {
+            for (int i = range.start; i < range.end; i++) {
+                try {
+                    results[i] = Verifier::verify(versions[i].first, versions[i].second);
+                } catch (const std::exception& e) {
+                    results[i].version = versions[i].first;
+                    results[i].status = VerificationResult::Status::Corrupted;
+                    results[i].detail = e.what();
+                }
+            }
+        });
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(endTime - startTime).count();
+        
+        size_t verified = 0, corrupted = 0, unverifiable = 0, legacy = 0;
+        size_t pixelBytes = 0;
+        for (const auto& result : results) {
+            pixelBytes += result.pixelBytes;
+            switch (result.status) {
+            case VerificationResult::Status::Verified:
+                verified++;
+                break;
+            case VerificationResult::Status::Unverifiable:
+                unverifiable++;
+                if (result.legacySnapshot) legacy++;
+                break;
+            case VerificationResult::Status::Corrupted:
+                corrupted++;
+                std::cout << "Version " << result.version << ": CORRUPTED - " << result.detail << "\n";
+                for (size_t k = 0; k < result.corruptTiles.size() && k < 5; k++) {
+                    const cv::Rect& r = result.corruptTiles[k];
+                    std::cout << "    tile at (" << r.x << ", " << r.y << ") size " << r.width << "x" << r.height << "\n";
+                }
+                if (result.corruptTiles.size() > 5) {
+                    std::cout << "    ... and " << (result.corruptTiles.size() - 5) << " more tiles\n";
+                }
+                break;
+            }
+        }
+        
+        std::cout << "Verified " << verified << ", corrupted " << corrupted << ", unverifiable " << unverifiable;
+        if (legacy > 0) {
+            std::cout << " (" << legacy << " with lossy JPEG snapshots)";
+        }
+        std::cout << ".\n";
+        std::cout << "Checked " << versions.size() << " versions in " << std::fixed << std::setprecision(2) << seconds << "s ("
+                  << std::setprecision(1) << (seconds > 0 ? versions.size() / seconds : 0.0) << " versions/s, "
+                  << (seconds > 0 ? pixelBytes / seconds / (1024.0 * 1024.0) : 0.0) << " MB/s of pixels)."
+                  << std::defaultfloat << "\n";
+    } catch (const std::out_of_range& e) {
+        std::cerr << "Error: Version number out of range\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+    }
+}
+
 // Shows help information
 void CLI::printHelp() const {
     std::cout << "Available commands:\n";
     std::cout << "  add <file_path>                                 Add an image file to the repository.\n";
+    std::cout << "  add --incremental <file_path>                   Add an edit of the current version, rehashing only changed tiles.\n";
+    std::cout << "  add-sequence <video|pattern>                    Add every frame of a video or numbered sequence (e.g. frame_%04d.png).\n";
     std::cout << "  commit                                          Commit the current changes.\n";
     std::cout << "  compare <v1> <v2> [sensitivity]                 Compare two versions using basic method.\n";
     std::cout << "                                                 Higher sensitivity (default 65) = less sensitive\n";
+    std::cout << "                                                 --level 1-3 compares the 1/2, 1/4 or 1/8 scale previews instead.\n";
     std::cout << "  advcompare <v1> <v2> [chunkSize] [sensitivity]  Compare using advanced Merkle/Quadtree method.\n";
     std::cout << "                                                 Higher sensitivity (default 10) = more tolerant\n";
-    std::cout << "  view <version>                                  View a specific version and display its image.\n";
+    std::cout << "                                                 --align [affine|homography] registers v2 onto v1 first.\n";
+    std::cout << "  compare <v1> <v2> --estimate [margin%]          Estimate the changed share by sampling tiles (default +/-1%).\n";
+    std::cout << "                                                 Both compares accept --roi x,y,w,h to compare one region only.\n";
+    std::cout << "                                                 --output <path|-> [--format json|bin] writes the regions, scores\n";
+    std::cout << "                                                 and statistics instead of an image; add --render [path] to also draw them.\n";
+    std::cout << "  view <version> [--full]                         View a version; shows a preview level unless --full is given.\n";
     std::cout << "  delete <version>                               Delete a specific version.\n";
-    std::cout << "  list                                           List all versions in the repository.\n";
+    std::cout << "  list [--thumbnails]                            List all versions; --thumbnails writes contact_sheet.jpg.\n";
+    std::cout << "  matrix [<from>-<to>|all] [output]               Pairwise similarity of versions (CSV, or binary for .bin).\n";
+    std::cout << "  find <file_path> [k]                            Find the k stored versions most similar to an image.\n";
+    std::cout << "  log [--stat]                                    Show the version history; --stat adds the tiles changed per version.\n";
+    std::cout << "  verify [version|all]                            Check stored snapshots and hashes against the recorded roots.\n";
+    std::cout << "  merge <base> <ours> <theirs> [--ours|--theirs]  Combine two edits of a base version tile by tile into a new version.\n";
+    std::cout << "  blame [version] [x,y,w,h] [--render [path]]     Show which version last changed each tile; --render draws an age map.\n";
+    std::cout << "  bundle create <destination-dir> <bundle-file>   Pack the versions another repository lacks, as changed tiles where possible.\n";
+    std::cout << "  bundle apply <bundle-file>                      Add the versions of a bundle that this repository lacks.\n";
+    std::cout << "  bisect <x,y,w,h> <good> <bad>                   Find the first version after <good> where the region changed.\n";
     std::cout << "  help                                            Show this help message.\n";
     std::cout << "  exit                                            Exit the application.\n";
+    std::cout << "Ctrl+C cancels a running add, add-sequence, advcompare or bundle; at the prompt it exits.\n";
 }
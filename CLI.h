@@ -1,26 +1,67 @@
 #ifndef CLI_H
 #define CLI_H
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include "Quadtree.h"
+#include "Repository.h"
+#include "HashStore.h"
+#include "PyramidStore.h"
+#include "ImageAligner.h"
+#include "DiffReport.h"
+#include "Progress.h"
+
+// Where compare and advcompare send their results
+struct DiffOutputOptions {
+    std::string reportPath;               // Structured report destination; empty for none, "-" for stdout
+    DiffFormat format = DiffFormat::Json;
+    bool render = true;                   // Write the highlighted image
+    std::string renderPath;               // Empty for the command's default file name
+};
 
 class CLI {
 public:
     void run();
+
+    // Asks the running command to stop at its next checkpoint. Returns false when no command
+    // is running or it was already asked; safe to call from a signal handler.
+    static bool interrupt();
 private:
-    void handleAdd(const std::string& filePath);
+    void handleAdd(const std::string& filePath, bool incremental = false);
+    void handleAddSequence(const std::string& source);
     void handleCommit();
-    void handleCompare(const std::string& version1, const std::string& version2, int sensitivity = 65);
-    void handleAdvancedCompare(const std::string& version1, const std::string& version2, int chunkSize = 16, int sensitivity = 10);
-    void handleView(const std::string& version);
+    void handleCompare(const std::string& version1, const std::string& version2, int sensitivity = 65,
+                       const cv::Rect& roi = cv::Rect(), int level = 0,
+                       const DiffOutputOptions& output = DiffOutputOptions());
+    void handleEstimate(const std::string& version1, const std::string& version2, double marginPercent,
+                        const cv::Rect& roi = cv::Rect());
+    void handleAdvancedCompare(const std::string& version1, const std::string& version2, int chunkSize = 16, int sensitivity = 10,
+                               const cv::Rect& roi = cv::Rect(), bool align = false,
+                               AlignmentModel model = AlignmentModel::Affine,
+                               const DiffOutputOptions& output = DiffOutputOptions());
+    void handleView(const std::string& version, bool full = false);
     void handleDelete(const std::string& version); 
-    void handleList();
+    void handleList(bool thumbnails = false);
+    void handleMatrix(const std::string& args);
+    void handleFind(const std::string& args);
+    void handleLog(bool stat);
+    void handleBisect(const std::string& args);
+    void handleBlame(const std::string& args);
+    void handleMerge(const std::string& args);
+    void handleVerify(const std::string& target);
+    void handleBundleCreate(const std::string& destination, const std::string& bundlePath);
+    void handleBundleApply(const std::string& bundlePath);
     void printHelp() const;
-    
-    // Helper functions for hashing
-    void collectLeafHashes(std::shared_ptr<QuadtreeNode> node, std::vector<std::string>& hashes);
-    std::string hashImageChunk(const cv::Mat& chunk);
+
+    int storeVersion(const VersionHashes& record, const std::vector<uchar>& encoded, const VersionSignature& signature,
+                     const EncodedPyramid& pyramid);
+
+    Repository repository;
+
+    // Cancelled by interrupt(); reset before each command
+    static CancellationToken commandToken;
+    static std::atomic<bool> commandRunning;
 };
 
 #endif // CLI_H
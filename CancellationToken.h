@@ -0,0 +1,32 @@
+#ifndef CANCELLATIONTOKEN_H
+#define CANCELLATIONTOKEN_H
+
+#include <atomic>
+#include <stdexcept>
+
+// Thrown at a checkpoint once the operation's token has been cancelled
+class OperationCancelled : public std::runtime_error {
+public:
+    OperationCancelled() : std::runtime_error("Operation cancelled") {}
+};
+
+// Flag shared between an operation and whoever may stop it. Long-running loops check it at
+// their checkpoints and unwind with OperationCancelled before touching the repository.
+// cancel() only stores to a lock-free atomic, so it may be called from a signal handler.
+class CancellationToken {
+public:
+    static_assert(ATOMIC_BOOL_LOCK_FREE == 2, "Cancellation must be async-signal-safe");
+
+    void cancel() noexcept { cancelled.store(true, std::memory_order_relaxed); }
+    void reset() noexcept { cancelled.store(false, std::memory_order_relaxed); }
+    bool isCancelled() const noexcept { return cancelled.load(std::memory_order_relaxed); }
+
+    void throwIfCancelled() const {
+        if (isCancelled()) throw OperationCancelled();
+    }
+
+private:
+    std::atomic<bool> cancelled{false};
+};
+
+#endif // CANCELLATIONTOKEN_H
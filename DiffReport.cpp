@@ -0,0 +1,151 @@
+#include "DiffReport.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <cstdio>
+#endif
+
+// Writes the report to a file, or to stdout for "-"
+void DiffReportWriter::write(const DiffReport& report, DiffFormat format, const std::string& path) {
+    if (path == "-") {
+        if (format == DiffFormat::Binary) {
+#ifdef _WIN32
+            // Keep the C runtime from translating newlines in the binary record
+            std::cout.flush();
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            writeBinary(report, std::cout);
+        } else {
+            writeJson(report, std::cout);
+        }
+        std::cout.flush();
+        return;
+    }
+
+    std::ofstream out(path, format == DiffFormat::Binary ? std::ios::binary : std::ios::out);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + path);
+    }
+    if (format == DiffFormat::Binary) {
+        writeBinary(report, out);
+    } else {
+        writeJson(report, out);
+    }
+    if (!out) {
+        throw std::runtime_error("Could not write the report to " + path);
+    }
+}
+
+// One JSON object; regions are listed one per line
+void DiffReportWriter::writeJson(const DiffReport& report, std::ostream& out) {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(6);
+
+    out << "{\n";
+    out << "  \"method\": \"" << report.method << "\",\n";
+    out << "  \"version1\": " << report.version1 << ",\n";
+    out << "  \"version2\": " << report.version2 << ",\n";
+    out << "  \"sensitivity\": " << report.sensitivity << ",\n";
+    if (report.chunkSize > 0) {
+        out << "  \"chunkSize\": " << report.chunkSize << ",\n";
+    }
+    out << "  \"level\": " << report.level << ",\n";
+    out << "  \"aligned\": " << (report.aligned ? "true" : "false") << ",\n";
+    out << "  \"width\": " << report.imageSize.width << ",\n";
+    out << "  \"height\": " << report.imageSize.height << ",\n";
+    out << "  \"area\": {\"x\": " << report.area.x << ", \"y\": " << report.area.y
+        << ", \"width\": " << report.area.width << ", \"height\": " << report.area.height << "},\n";
+    out << "  \"changedArea\": " << report.changedArea << ",\n";
+    if (report.hasLeafStats) {
+        out << "  \"leaves\": {\"checksum\": " << report.leafStats.checksumMatches
+            << ", \"fastHash\": " << report.leafStats.fastHashMatches
+            << ", \"perceptual\": " << report.leafStats.perceptualMatches
+            << ", \"refined\": " << report.leafStats.mismatches << "},\n";
+    }
+    out << "  \"elapsedMs\": " << std::setprecision(1) << report.elapsedMs << std::setprecision(6) << ",\n";
+    out << "  \"regions\": [";
+    for (size_t i = 0; i < report.regions.size(); i++) {
+        const DiffRegion& region = report.regions[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"x\": " << region.rect.x << ", \"y\": " << region.rect.y
+            << ", \"width\": " << region.rect.width << ", \"height\": " << region.rect.height
+            << ", \"meanDifference\": " << region.meanDifference
+            << ", \"changedFraction\": " << region.changedFraction << "}";
+    }
+    out << (report.regions.empty() ? "]\n" : "\n  ]\n");
+    out << "}\n";
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+// Layout, all in native byte order:
+//   "VDIF", uint32 format version (1)
+//   int32 method (0 compare, 1 advcompare), version1, version2, sensitivity, chunkSize, level, aligned
+//   int32 width, height, area x, y, width, height
+//   float64 changedArea, elapsedMs
+//   uint64 leaves resolved by checksum, fast hash, perceptual hash, refined (all 0 for compare)
+//   uint32 region count, then per region int32 x, y, width, height and float32 meanDifference, changedFraction
+void DiffReportWriter::writeBinary(const DiffReport& report, std::ostream& out) {
+    auto writeValue = [&out](const auto& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    out.write("VDIF", 4);
+    writeValue(static_cast<uint32_t>(1));
+
+    const int32_t header[] = {
+        report.method == "advcompare" ? 1 : 0, report.version1, report.version2, report.sensitivity,
+        report.chunkSize, report.level, report.aligned ? 1 : 0,
+        report.imageSize.width, report.imageSize.height,
+        report.area.x, report.area.y, report.area.width, report.area.height
+    };
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    writeValue(report.changedArea);
+    writeValue(report.elapsedMs);
+
+    const uint64_t leaves[] = {
+        report.leafStats.checksumMatches, report.leafStats.fastHashMatches,
+        report.leafStats.perceptualMatches, report.leafStats.mismatches
+    };
+    out.write(reinterpret_cast<const char*>(leaves), sizeof(leaves));
+
+    writeValue(static_cast<uint32_t>(report.regions.size()));
+    for (const DiffRegion& region : report.regions) {
+        const int32_t rect[] = { region.rect.x, region.rect.y, region.rect.width, region.rect.height };
+        out.write(reinterpret_cast<const char*>(rect), sizeof(rect));
+        writeValue(static_cast<float>(region.meanDifference));
+        writeValue(static_cast<float>(region.changedFraction));
+    }
+}
+
+bool DiffReportWriter::parseFormat(const std::string& name, DiffFormat& format) {
+    if (name == "json") {
+        format = DiffFormat::Json;
+    } else if (name == "bin") {
+        format = DiffFormat::Binary;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+double DiffReportWriter::coveredFraction(const std::vector<DiffRegion>& regions, const cv::Rect& area) {
+    if (area.area() <= 0) {
+        return 0.0;
+    }
+    double covered = 0.0;
+    for (const DiffRegion& region : regions) {
+        covered += (region.rect & area).area();
+    }
+    return std::min(1.0, covered / area.area());
+}
@@ -0,0 +1,44 @@
+#ifndef DIFFREPORT_H
+#define DIFFREPORT_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "ImageComparer.h"
+
+// Result of a compare or advcompare, for pipelines that consume the regions rather than an image
+struct DiffReport {
+    std::string method;               // "compare" or "advcompare"
+    int version1 = 0;
+    int version2 = 0;
+    int sensitivity = 0;
+    int chunkSize = 0;                // Leaf size of advcompare; 0 for compare
+    int level = 0;                    // Pyramid level compared; 0 for the full snapshots
+    bool aligned = false;             // The second version was registered onto the first
+    cv::Size imageSize;
+    cv::Rect area;                    // Compared area, in image coordinates
+    std::vector<DiffRegion> regions;  // Merged regions, in image coordinates
+    double changedArea = 0.0;         // Share of the compared area covered by regions
+    bool hasLeafStats = false;
+    LeafComparisonStats leafStats;    // Only filled by advcompare
+    double elapsedMs = 0.0;
+};
+
+enum class DiffFormat { Json, Binary };
+
+// Writes DiffReports as JSON or as a compact binary record ("VDIF", native byte order).
+// The path "-" streams the report to stdout.
+class DiffReportWriter {
+public:
+    static void write(const DiffReport& report, DiffFormat format, const std::string& path);
+    static void writeJson(const DiffReport& report, std::ostream& out);
+    static void writeBinary(const DiffReport& report, std::ostream& out);
+
+    // "json" or "bin"
+    static bool parseFormat(const std::string& name, DiffFormat& format);
+    // Share of `area` covered by the regions; merged regions do not overlap
+    static double coveredFraction(const std::vector<DiffRegion>& regions, const cv::Rect& area);
+};
+
+#endif // DIFFREPORT_H
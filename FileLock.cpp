@@ -0,0 +1,63 @@
+#include "FileLock.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+// Locks the whole file with LockFileEx, blocking until it is available
+FileLock::FileLock(const std::string& path, bool exclusive) {
+    handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                         nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Could not open lock file: " + path);
+    }
+
+    OVERLAPPED overlapped = {};
+    DWORD flags = exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0;
+    if (!LockFileEx(handle, flags, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+        CloseHandle(handle);
+        throw std::runtime_error("Could not lock file: " + path);
+    }
+}
+
+FileLock::~FileLock() {
+    OVERLAPPED overlapped = {};
+    UnlockFileEx(handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+    CloseHandle(handle);
+}
+
+#else
+
+// Locks the file with flock, blocking until it is available
+FileLock::FileLock(const std::string& path, bool exclusive) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open lock file: " + path);
+    }
+
+    int result;
+    do {
+        result = flock(fd, exclusive ? LOCK_EX : LOCK_SH);
+    } while (result != 0 && errno == EINTR);
+
+    if (result != 0) {
+        close(fd);
+        throw std::runtime_error("Could not lock file: " + path);
+    }
+}
+
+FileLock::~FileLock() {
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef FILELOCK_H
+#define FILELOCK_H
+
+#include <string>
+
+// Advisory lock on a file, shared by every Versionary process working in the same directory.
+// The lock is taken in the constructor and released when the object goes out of scope.
+class FileLock {
+public:
+    explicit FileLock(const std::string& path, bool exclusive = true);
+    ~FileLock();
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+#ifdef _WIN32
+    void* handle;
+#else
+    int fd;
+#endif
+};
+
+#endif // FILELOCK_H
@@ -0,0 +1,174 @@
+#include "HashStore.h"
+#include "Quadtree.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// Returns the Merkle root stored in the record
+std::string VersionHashes::rootHash() const {
+    return (merkleLevels.empty() || merkleLevels.back().empty()) ? "" : merkleLevels.back().front();
+}
+
+// Path of the hash record for a version
+std::string HashStore::pathFor(int version) {
+    return "version_" + std::to_string(version) + ".hashes";
+}
+
+// Writes the hash record for a version
+// Format: a header, one "<checksum> <hash>" line per leaf, then the Merkle levels above the leaves
+void HashStore::save(int version, const VersionHashes& hashes) {
+    std::string filename = pathFor(version);
+    std::ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+
+    outfile << "versionary-hashes 1\n";
+    outfile << "size " << hashes.imageSize.width << " " << hashes.imageSize.height << "\n";
+    outfile << "minsize " << hashes.minSize << "\n";
+
+    outfile << "leaves " << hashes.leafHashes.size() << "\n";
+    char checksum[17];
+    for (size_t i = 0; i < hashes.leafHashes.size(); i++) {
+        std::snprintf(checksum, sizeof(checksum), "%016llx", static_cast<unsigned long long>(hashes.checksums[i]));
+        outfile << checksum << " " << hashes.leafHashes[i] << "\n";
+    }
+
+    // Level 0 is the leaf hashes written above
+    for (size_t l = 1; l < hashes.merkleLevels.size(); l++) {
+        outfile << "level " << hashes.merkleLevels[l].size() << "\n";
+        for (const auto& digest : hashes.merkleLevels[l]) {
+            outfile << digest << "\n";
+        }
+    }
+
+    if (!outfile) {
+        throw std::runtime_error("Failed to write hash record: " + filename);
+    }
+}
+
+// Reads the hash record for a version; returns false if there is none
+bool HashStore::load(int version, VersionHashes& hashes) {
+    return loadFile(pathFor(version), hashes);
+}
+
+bool HashStore::loadFile(const std::string& path, VersionHashes& hashes) {
+    std::ifstream infile(path);
+    if (!infile.is_open()) {
+        return false;
+    }
+
+    VersionHashes loaded;
+    std::string line;
+    if (!std::getline(infile, line) || line != "versionary-hashes 1") {
+        std::cerr << "Error: Unrecognised hash record format in " << path << std::endl;
+        return false;
+    }
+
+    try {
+        while (std::getline(infile, line)) {
+            std::istringstream iss(line);
+            std::string key;
+            iss >> key;
+
+            if (key == "size") {
+                iss >> loaded.imageSize.width >> loaded.imageSize.height;
+            } else if (key == "minsize") {
+                iss >> loaded.minSize;
+            } else if (key == "leaves") {
+                size_t count = 0;
+                iss >> count;
+                loaded.checksums.reserve(count);
+                loaded.leafHashes.reserve(count);
+                for (size_t i = 0; i < count && std::getline(infile, line); i++) {
+                    std::istringstream leaf(line);
+                    std::string checksum, hash;
+                    leaf >> checksum >> hash;
+                    loaded.checksums.push_back(std::stoull(checksum, nullptr, 16));
+                    loaded.leafHashes.push_back(hash);
+                }
+                loaded.merkleLevels.push_back(loaded.leafHashes);
+            } else if (key == "level") {
+                size_t count = 0;
+                iss >> count;
+                std::vector<std::string> level;
+                level.reserve(count);
+                for (size_t i = 0; i < count && std::getline(infile, line); i++) {
+                    level.push_back(line);
+                }
+                loaded.merkleLevels.push_back(std::move(level));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Corrupt hash record " << path << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    if (loaded.imageSize.width <= 0 || loaded.imageSize.height <= 0 || loaded.minSize <= 0) {
+        std::cerr << "Error: Incomplete hash record in " << path << std::endl;
+        return false;
+    }
+
+    loaded.regions = Quadtree::leafRegions(loaded.imageSize, loaded.minSize);
+    if (loaded.regions.size() != loaded.leafHashes.size()) {
+        std::cerr << "Error: Hash record " << path << " does not match its leaf layout" << std::endl;
+        return false;
+    }
+
+    hashes = std::move(loaded);
+    return true;
+}
+
+// Path of the signature for a version
+std::string HashStore::signaturePathFor(int version) {
+    return "version_" + std::to_string(version) + ".sig";
+}
+
+// Writes a signature as one line: global hash, cell count, cell hashes (all hex)
+void HashStore::saveSignature(int version, const VersionSignature& signature) {
+    std::string filename = signaturePathFor(version);
+    std::ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+
+    outfile << std::hex << signature.globalHash << " " << std::dec << signature.gridHashes.size() << std::hex;
+    for (uint64_t cell : signature.gridHashes) {
+        outfile << " " << cell;
+    }
+    outfile << "\n";
+}
+
+// Reads a signature; returns false if there is none or it is malformed
+bool HashStore::loadSignature(int version, VersionSignature& signature) {
+    std::ifstream infile(signaturePathFor(version));
+    if (!infile.is_open()) {
+        return false;
+    }
+
+    VersionSignature loaded;
+    size_t cells = 0;
+    if (!(infile >> std::hex >> loaded.globalHash >> std::dec >> cells) ||
+        cells != static_cast<size_t>(VersionSignature::GRID * VersionSignature::GRID)) {
+        return false;
+    }
+
+    loaded.gridHashes.resize(cells);
+    infile >> std::hex;
+    for (size_t i = 0; i < cells; i++) {
+        if (!(infile >> loaded.gridHashes[i])) {
+            return false;
+        }
+    }
+
+    signature = std::move(loaded);
+    return true;
+}
+
+// Deletes the hash record and signature for a version, if any
+void HashStore::remove(int version) {
+    std::remove(pathFor(version).c_str());
+    std::remove(signaturePathFor(version).c_str());
+}
@@ -0,0 +1,48 @@
+#ifndef HASHSTORE_H
+#define HASHSTORE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Per-version hash record: everything needed to compare or extend a version
+// without decoding its image again
+struct VersionHashes {
+    cv::Size imageSize;
+    int minSize = 0;
+    std::vector<cv::Rect> regions;       // Quadtree leaf regions, traversal order
+    std::vector<uint64_t> checksums;     // Checksum of each leaf's raw pixel bytes
+    std::vector<std::string> leafHashes; // Perceptual hash of each leaf
+    std::vector<std::vector<std::string>> merkleLevels; // Leaves first, root last
+
+    std::string rootHash() const;
+};
+
+// Compact whole-image signature used for version-to-version similarity:
+// a global perceptual hash plus one perceptual hash per cell of a fixed grid
+struct VersionSignature {
+    static const int GRID = 8;
+
+    uint64_t globalHash = 0;
+    std::vector<uint64_t> gridHashes; // GRID * GRID cells, row-major
+};
+
+// Stores hash records as version_<N>.hashes and signatures as version_<N>.sig
+// next to the version images
+class HashStore {
+public:
+    static std::string pathFor(int version);
+    static void save(int version, const VersionHashes& hashes);
+    static bool load(int version, VersionHashes& hashes);
+    // Reads a hash record from any path, such as one in another repository directory
+    static bool loadFile(const std::string& path, VersionHashes& hashes);
+
+    static std::string signaturePathFor(int version);
+    static void saveSignature(int version, const VersionSignature& signature);
+    static bool loadSignature(int version, VersionSignature& signature);
+
+    static void remove(int version);
+};
+
+#endif // HASHSTORE_H
@@ -0,0 +1,133 @@
+#include "ImageAligner.h"
+#include "ImageProcessor.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// 8-bit grayscale copy halved until its longest side fits MAX_FEATURE_SIDE; `scale` maps its
+// coordinates back to the full image. ORB only takes 8-bit input; the warp itself is done
+// at the image's own depth.
+cv::Mat ImageAligner::matchingLevel(const cv::Mat& image, cv::Size2d& scale) {
+    cv::Mat level;
+    if (image.channels() == 3 || image.channels() == 4) {
+        ImageProcessor::convertToGrayscale(image, level);
+    } else {
+        level = image;
+    }
+    if (level.depth() != CV_8U) {
+        cv::Mat narrowed;
+        level.convertTo(narrowed, CV_8U, ImageProcessor::maxValue(CV_8U) / ImageProcessor::maxValue(level.depth()));
+        level = narrowed;
+    }
+
+    while (std::max(level.cols, level.rows) > MAX_FEATURE_SIDE) {
+        cv::Mat smaller;
+        cv::pyrDown(level, smaller);
+        level = smaller;
+    }
+
+    scale = cv::Size2d(static_cast<double>(image.cols) / level.cols,
+                       static_cast<double>(image.rows) / level.rows);
+    return level;
+}
+
+// Matches ORB features on the downsampled levels, estimates the transform with RANSAC
+// at full resolution and warps image2 with it
+AlignmentResult ImageAligner::align(const cv::Mat& image1, const cv::Mat& image2, cv::Mat& aligned,
+                                    AlignmentModel model) {
+    AlignmentResult result;
+    aligned = image2;
+
+    cv::Size2d scale1, scale2;
+    cv::Mat level1 = matchingLevel(image1, scale1);
+    cv::Mat level2 = matchingLevel(image2, scale2);
+
+    cv::Ptr<cv::ORB> orb = cv::ORB::create(MAX_FEATURES);
+    std::vector<cv::KeyPoint> keypoints1, keypoints2;
+    cv::Mat descriptors1, descriptors2;
+    orb->detectAndCompute(level1, cv::noArray(), keypoints1, descriptors1);
+    orb->detectAndCompute(level2, cv::noArray(), keypoints2, descriptors2);
+    if (descriptors1.empty() || descriptors2.empty()) {
+        return result;
+    }
+
+    // Keep matches clearly better than the runner-up (Lowe's ratio test)
+    cv::BFMatcher matcher(cv::NORM_HAMMING);
+    std::vector<std::vector<cv::DMatch>> candidates;
+    matcher.knnMatch(descriptors2, descriptors1, candidates, 2);
+
+    std::vector<cv::Point2f> points1, points2;
+    for (const auto& pair : candidates) {
+        if (pair.size() < 2 || pair[0].distance >= 0.75f * pair[1].distance) continue;
+        const cv::Point2f& p1 = keypoints1[pair[0].trainIdx].pt;
+        const cv::Point2f& p2 = keypoints2[pair[0].queryIdx].pt;
+        points1.push_back(cv::Point2f(static_cast<float>(p1.x * scale1.width), static_cast<float>(p1.y * scale1.height)));
+        points2.push_back(cv::Point2f(static_cast<float>(p2.x * scale2.width), static_cast<float>(p2.y * scale2.height)));
+    }
+    result.matches = static_cast<int>(points1.size());
+    if (result.matches < MIN_INLIERS) {
+        return result;
+    }
+
+    // The RANSAC tolerance is three pixels of the matching level, expressed at full resolution
+    double threshold = 3.0 * std::max(scale1.width, scale1.height);
+    cv::Mat inlierMask;
+    cv::Mat transform;
+    if (model == AlignmentModel::Homography) {
+        transform = cv::findHomography(points2, points1, cv::RANSAC, threshold, inlierMask);
+    } else {
+        cv::Mat affine = cv::estimateAffine2D(points2, points1, inlierMask, cv::RANSAC, threshold);
+        if (!affine.empty()) {
+            transform = cv::Mat::eye(3, 3, CV_64F);
+            affine.copyTo(transform(cv::Rect(0, 0, 3, 2)));
+        }
+    }
+    if (transform.empty()) {
+        return result;
+    }
+    result.inliers = cv::countNonZero(inlierMask);
+    if (result.inliers < MIN_INLIERS) {
+        return result;
+    }
+
+    // How far the transform moves each corner of image2
+    std::vector<cv::Point2f> corners = {
+        cv::Point2f(0.0f, 0.0f), cv::Point2f(static_cast<float>(image2.cols), 0.0f),
+        cv::Point2f(static_cast<float>(image2.cols), static_cast<float>(image2.rows)),
+        cv::Point2f(0.0f, static_cast<float>(image2.rows))
+    };
+    std::vector<cv::Point2f> moved;
+    cv::perspectiveTransform(corners, moved, transform);
+
+    cv::Point2f firstShift = moved[0] - corners[0];
+    cv::Point2f wholeShift(std::round(firstShift.x), std::round(firstShift.y));
+    bool wholePixelShift = true;
+    for (size_t i = 0; i < corners.size(); i++) {
+        cv::Point2f shift = moved[i] - corners[i];
+        result.shift = std::max(result.shift, static_cast<double>(std::hypot(shift.x, shift.y)));
+        cv::Point2f residual = shift - wholeShift;
+        if (std::abs(residual.x) > 0.1f || std::abs(residual.y) > 0.1f) {
+            wholePixelShift = false;
+        }
+    }
+
+    result.aligned = true;
+    result.transform = transform;
+
+    if (wholePixelShift) {
+        // A whole-pixel move (including none) is copied rather than resampled, so tiles that
+        // did not change stay byte-identical and still match on the checksum tier
+        result.exact = true;
+        if (wholeShift == cv::Point2f(0.0f, 0.0f) && image1.size() == image2.size()) {
+            return result;
+        }
+        cv::Mat translation = cv::Mat::eye(2, 3, CV_64F);
+        translation.at<double>(0, 2) = wholeShift.x;
+        translation.at<double>(1, 2) = wholeShift.y;
+        cv::warpAffine(image2, aligned, translation, image1.size(), cv::INTER_NEAREST, cv::BORDER_CONSTANT);
+    } else {
+        cv::warpPerspective(image2, aligned, transform, image1.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    }
+
+    return result;
+}
@@ -0,0 +1,37 @@
+#ifndef IMAGEALIGNER_H
+#define IMAGEALIGNER_H
+
+#include <opencv2/opencv.hpp>
+
+// Transform estimated between two versions
+enum class AlignmentModel { Affine, Homography };
+
+// Outcome of an alignment attempt
+struct AlignmentResult {
+    bool aligned = false;     // False when too few reliable matches were found
+    cv::Mat transform;        // 3x3 CV_64F, maps image2 coordinates onto image1 (full resolution)
+    int matches = 0;          // Matches that passed the ratio test
+    int inliers = 0;          // Matches consistent with the transform
+    double shift = 0.0;       // Largest corner displacement, in pixels
+    bool exact = false;       // Warped with a whole-pixel shift, so pixel values are unchanged
+};
+
+// Registers a second version onto the first before a structural compare, so a slightly
+// cropped, scaled or rotated version is not reported as different everywhere.
+// Features are matched on a downsampled copy and the transform is scaled back up.
+class ImageAligner {
+public:
+    // Warps image2 onto image1's frame. If no reliable transform is found, `aligned` is
+    // image2 unchanged and result.aligned is false.
+    static AlignmentResult align(const cv::Mat& image1, const cv::Mat& image2, cv::Mat& aligned,
+                                 AlignmentModel model = AlignmentModel::Affine);
+
+private:
+    static const int MAX_FEATURE_SIDE = 1024; // Longest side of the level used for matching
+    static const int MAX_FEATURES = 2000;
+    static const int MIN_INLIERS = 12;
+
+    static cv::Mat matchingLevel(const cv::Mat& image, cv::Size2d& scale);
+};
+
+#endif // IMAGEALIGNER_H
@@ -1,139 +1,416 @@
 #include "ImageComparer.h"
+#include "ImageProcessor.h"
 #include <iostream>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include "Quadtree.h"
-#include "MerkleTree.h"
 #include "Utils.h"
+#include "LeafHasher.h"
+#include "TileKernels.h"
+#include "AllocProfiler.h"
+#include <algorithm>
+#include <climits>
+#include <limits>
+#include <cmath>
+#include <random>
 #include <map>
 #include <sstream>
-#include <unordered_set>
 
-// Basic pixel-by-pixel comparison of two images
-// Returns an image highlighting the differences
-cv::Mat ImageComparer::compareImages(const cv::Mat& image1, const cv::Mat& image2, int sensitivity) {
-    if (image1.empty() || image2.empty()) {
-        throw std::runtime_error("One or both images are empty");
+// Returns a view of the requested size into a grow-only buffer; a buffer of another type is replaced
+static cv::Mat scratchView(cv::Mat& buffer, const cv::Size& size, int type = CV_8UC1) {
+    if (buffer.type() != type) {
+        buffer.release();
+    }
+    if (buffer.rows < size.height || buffer.cols < size.width) {
+        buffer.create(std::max(buffer.rows, size.height), std::max(buffer.cols, size.width), type);
     }
+    return buffer(cv::Rect(0, 0, size.width, size.height));
+}
 
-    cv::Mat result;
-    
-    if (image1.channels() == 1) {
-        cv::cvtColor(image1, result, cv::COLOR_GRAY2BGR);
+// Second image resized to the first one's size, and both in a common pixel format
+static void prepareInputs(const cv::Mat& image1, const cv::Mat& image2, cv::Mat& first, cv::Mat& second) {
+    first = image1;
+    if (image1.size() != image2.size()) {
+        cv::resize(image2, second, image1.size());
     } else {
-        image1.copyTo(result);
+        second = image2;
+    }
+    ImageProcessor::matchFormats(first, second);
+}
+
+// Per-thread tile buffers for the fused difference mask; like the refinement buffers they only grow
+struct DifferenceMaskScratch {
+    cv::Mat gray1;
+    cv::Mat gray2;
+    cv::Mat blurred1;
+    cv::Mat blurred2;
+    cv::Mat mask;
+};
+
+// absdiff and THRESH_BINARY in one pass; max - min keeps the loop in the pixel type so the
+// compiler vectorises it at either depth
+template <typename T>
+static void thresholdDifference(const cv::Mat& blurred1, const cv::Mat& blurred2, int threshold, cv::Mat& mask) {
+    const bool allSet = threshold < 0;
+    const T limit = static_cast<T>(std::min(std::max(threshold, 0), static_cast<int>(std::numeric_limits<T>::max())));
+    for (int row = 0; row < mask.rows; row++) {
+        const T* p1 = blurred1.ptr<T>(row);
+        const T* p2 = blurred2.ptr<T>(row);
+        uchar* out = mask.ptr<uchar>(row);
+        for (int col = 0; col < mask.cols; col++) {
+            T diff = static_cast<T>(std::max(p1[col], p2[col]) - std::min(p1[col], p2[col]));
+            out[col] = (allSet || diff > limit) ? 255 : 0;
+        }
     }
+}
+
+// Pixel-level difference mask of `area`, built one cache-sized tile at a time into `mask`,
+// which covers just that area (it may be a view into a larger mask). Both images must share
+// a pixel format; `sensitivity` is in 8-bit units.
+// Each tile is processed with a halo of MASK_HALO pixels: the blur consumes one and the
+// close/open pair (two 3x3 erosions and two dilations) consumes four, so the core of every
+// tile matches the whole-image pipeline exactly while the intermediates stay in cache.
+void ImageComparer::computeDifferenceMask(const cv::Mat& image1, const cv::Mat& image2, int sensitivity,
+                                          const cv::Rect& area, cv::Mat& mask) {
+    thread_local DifferenceMaskScratch scratch;
     
-    // Resize second image if dimensions don't match
-    cv::Mat resizedImage2;
-    if (image1.size() != image2.size()) {
-        cv::resize(image2, resizedImage2, image1.size());
-    } else {
-        resizedImage2 = image2;
+    const cv::Rect bounds(0, 0, image1.cols, image1.rows);
+    const cv::Rect target = area & bounds;
+    mask.create(target.size(), CV_8UC1);
+    const int blurBorder = cv::BORDER_DEFAULT | cv::BORDER_ISOLATED;
+    const int morphBorder = cv::BORDER_CONSTANT | cv::BORDER_ISOLATED;
+    const int grayType = CV_MAKETYPE(image1.depth(), 1);
+    const int limit = ImageProcessor::scaleThreshold(sensitivity, image1.depth());
+    
+    for (int y = target.y; y < target.y + target.height; y += MASK_TILE) {
+        for (int x = target.x; x < target.x + target.width; x += MASK_TILE) {
+            cv::Rect core(x, y,
+                          std::min(MASK_TILE, target.x + target.width - x),
+                          std::min(MASK_TILE, target.y + target.height - y));
+            cv::Rect outer = cv::Rect(core.x - MASK_HALO, core.y - MASK_HALO,
+                                      core.width + 2 * MASK_HALO, core.height + 2 * MASK_HALO) & bounds;
+            
+            // Where the halo is clipped by the image the buffer edge is the image edge, and the
+            // isolated borders below treat it exactly as the full-image filters would
+            cv::Mat gray1 = scratchView(scratch.gray1, outer.size(), grayType);
+            cv::Mat gray2 = scratchView(scratch.gray2, outer.size(), grayType);
+            ImageProcessor::convertToGrayscale(image1(outer), gray1);
+            ImageProcessor::convertToGrayscale(image2(outer), gray2);
+            
+            cv::Mat blurred1 = scratchView(scratch.blurred1, outer.size(), grayType);
+            cv::Mat blurred2 = scratchView(scratch.blurred2, outer.size(), grayType);
+            cv::GaussianBlur(gray1, blurred1, cv::Size(3, 3), 0, 0, blurBorder);
+            cv::GaussianBlur(gray2, blurred2, cv::Size(3, 3), 0, 0, blurBorder);
+            
+            cv::Mat tileMask = scratchView(scratch.mask, outer.size());
+            if (grayType == CV_16UC1) {
+                thresholdDifference<uint16_t>(blurred1, blurred2, limit, tileMask);
+            } else {
+                thresholdDifference<uchar>(blurred1, blurred2, limit, tileMask);
+            }
+            
+            cv::morphologyEx(tileMask, tileMask, cv::MORPH_CLOSE, morphologyKernel(),
+                             cv::Point(-1, -1), 1, morphBorder, cv::morphologyDefaultBorderValue());
+            cv::morphologyEx(tileMask, tileMask, cv::MORPH_OPEN, morphologyKernel(),
+                             cv::Point(-1, -1), 1, morphBorder, cv::morphologyDefaultBorderValue());
+            
+            tileMask(cv::Rect(core.x - outer.x, core.y - outer.y, core.width, core.height)).copyTo(mask(core - target.tl()));
+        }
     }
+}
+
+// Orders contours by their first point, which findContours always places on the component's
+// topmost-then-leftmost pixel, so the order does not depend on how the mask was scanned
+static void sortContours(std::vector<std::vector<cv::Point>>& contours) {
+    std::sort(contours.begin(), contours.end(), [](const std::vector<cv::Point>& a, const std::vector<cv::Point>& b) {
+        return a[0].y != b[0].y ? a[0].y < b[0].y : a[0].x < b[0].x;
+    });
+}
+
+// External contours of the difference mask over `area`, computed in horizontal stripes in parallel.
+// Each stripe builds its part of the mask and extracts its own contours. Components that reach
+// a stripe edge may continue in the next stripe, so they are flood-filled from the complete
+// mask and extracted again as a whole; stripe contours lying inside the hole of such a component
+// are dropped, as RETR_EXTERNAL would not have reported them. The result is the same contour
+// set as one findContours call over the whole mask, but not in findContours' border-following
+// order: contours are sorted by their topmost-then-leftmost point (see sortContours), so the
+// order is the same for every stripe count. Contours are returned in image coordinates; the
+// mask itself only covers the area.
+std::vector<std::vector<cv::Point>> ImageComparer::findDifferenceContours(const cv::Mat& image1, const cv::Mat& image2,
+                                                                          int sensitivity, const cv::Rect& area) {
+    const int rows = area.height;
+    const int cols = area.width;
+    const int stripeCount = std::max(1, std::min(cv::getNumThreads() * 2, rows / MIN_STRIPE_ROWS));
     
-    // Convert both images to grayscale
-    cv::Mat gray1, gray2;
-    if (image1.channels() == 3 || image1.channels() == 4) {
-        cv::cvtColor(image1, gray1, cv::COLOR_BGR2GRAY);
-    } else {
-        gray1 = image1.clone();
+    cv::Mat mask(area.size(), CV_8UC1);
+    std::vector<std::vector<std::vector<cv::Point>>> stripeContours(stripeCount);
+    std::vector<std::vector<cv::Point>> stripeSeeds(stripeCount);
+    
+    cv::parallel_for_(cv::Range(0, stripeCount), [&](const cv::Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = s * rows / stripeCount;
+            const int y1 = (s + 1) * rows / stripeCount;
+            const cv::Rect stripe(0, y0, cols, y1 - y0);
+            
+            cv::Mat stripeMask = mask(stripe);
+            computeDifferenceMask(image1, image2, sensitivity, stripe + area.tl(), stripeMask);
+            
+            std::vector<std::vector<cv::Point>> found;
+            cv::findContours(stripeMask, found, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE, cv::Point(area.x, area.y + y0));
+            
+            for (auto& contour : found) {
+                cv::Rect box = cv::boundingRect(contour);
+                bool crossesTop = y0 > 0 && box.y == area.y + y0;
+                bool crossesBottom = y1 < rows && box.y + box.height == area.y + y1;
+                if (crossesTop || crossesBottom) {
+                    stripeSeeds[s].push_back(contour[0] - area.tl());
+                } else {
+                    stripeContours[s].push_back(std::move(contour));
+                }
+            }
+        }
+    });
+    
+    std::vector<std::vector<cv::Point>> contours;
+    for (auto& found : stripeContours) {
+        for (auto& contour : found) {
+            contours.push_back(std::move(contour));
+        }
     }
     
-    if (resizedImage2.channels() == 3 || resizedImage2.channels() == 4) {
-        cv::cvtColor(resizedImage2, gray2, cv::COLOR_BGR2GRAY);
-    } else {
-        gray2 = resizedImage2.clone();
+    // Re-extract the components that reach a stripe edge from a mask holding only them
+    // (seeds and fill rectangles are relative to the area)
+    cv::Mat crossingMask;
+    cv::Rect crossingArea;
+    const int fillFlags = 8 | cv::FLOODFILL_MASK_ONLY | (255 << 8);
+    for (const auto& seeds : stripeSeeds) {
+        for (const auto& seed : seeds) {
+            if (crossingMask.empty()) {
+                crossingMask = cv::Mat::zeros(rows + 2, cols + 2, CV_8UC1);
+            }
+            if (crossingMask.at<uchar>(seed.y + 1, seed.x + 1)) continue; // Component already filled
+            
+            cv::Rect filled;
+            cv::floodFill(mask, crossingMask, seed, cv::Scalar(255), &filled, cv::Scalar(0), cv::Scalar(0), fillFlags);
+            crossingArea = crossingArea.empty() ? filled : (crossingArea | filled);
+        }
     }
     
-    // Apply blur to reduce noise
-    cv::GaussianBlur(gray1, gray1, cv::Size(3, 3), 0);
-    cv::GaussianBlur(gray2, gray2, cv::Size(3, 3), 0);
+    if (!crossingMask.empty()) {
+        std::vector<std::vector<cv::Point>> crossing;
+        cv::findContours(crossingMask(crossingArea + cv::Point(1, 1)), crossing, cv::RETR_EXTERNAL,
+                         cv::CHAIN_APPROX_SIMPLE, crossingArea.tl() + area.tl());
+        
+        std::vector<cv::Rect> crossingBoxes;
+        for (const auto& contour : crossing) {
+            crossingBoxes.push_back(cv::boundingRect(contour));
+        }
+        
+        // A stripe component never touches a crossing one, so any of its pixels lies strictly
+        // inside a crossing contour only if it sits in that component's hole
+        contours.erase(std::remove_if(contours.begin(), contours.end(), [&](const std::vector<cv::Point>& contour) {
+            for (size_t i = 0; i < crossing.size(); i++) {
+                if (crossingBoxes[i].contains(contour[0]) &&
+                    cv::pointPolygonTest(crossing[i], cv::Point2f(contour[0]), false) > 0) {
+                    return true;
+                }
+            }
+            return false;
+        }), contours.end());
+        
+        for (auto& contour : crossing) {
+            contours.push_back(std::move(contour));
+        }
+    }
     
-    // Calculate absolute difference between images
-    cv::Mat diffMap;
-    cv::absdiff(gray1, gray2, diffMap);
+    sortContours(contours);
+    return contours;
+}
+
+// Basic pixel-by-pixel comparison of two images
+// Returns an image highlighting the differences, found only inside `roi` when one is given
+cv::Mat ImageComparer::compareImages(const cv::Mat& image1, const cv::Mat& image2, int sensitivity, const cv::Rect& roi) {
+    if (image1.empty() || image2.empty()) {
+        throw std::runtime_error("One or both images are empty");
+    }
     
-    // Apply threshold to identify significant differences
-    cv::Mat thresholdedDiff;
-    cv::threshold(diffMap, thresholdedDiff, sensitivity, 255, cv::THRESH_BINARY);
+    cv::Rect area = comparisonArea(image1.size(), roi);
+
+    // Differences are found at the native format; only the visualisation is 8-bit BGR
+    cv::Mat result;
     
-    // Clean up the difference map using morphological operations
-    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-    cv::morphologyEx(thresholdedDiff, thresholdedDiff, cv::MORPH_CLOSE, kernel);
-    cv::morphologyEx(thresholdedDiff, thresholdedDiff, cv::MORPH_OPEN, kernel);
+    if (image1.type() == CV_8UC3) {
+        image1.copyTo(result);
+    } else {
+        result = ImageProcessor::toDisplay(image1);
+    }
     
-    // Find contours in the difference map
-    std::vector<std::vector<cv::Point>> contours;
-    cv::findContours(thresholdedDiff, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    std::vector<std::vector<cv::Point>> contours = significantContours(image1, image2, sensitivity, area);
     
-    // Highlight contours above minimum size
+    // Highlight the contours. Blending is limited to each contour's bounding box,
+    // since the overlay is zero everywhere else.
     for (const auto& contour : contours) {
-        if (cv::contourArea(contour) > 100) {
-            cv::Rect boundingRect = cv::boundingRect(contour);
-            
-            cv::Mat mask = cv::Mat::zeros(result.size(), CV_8UC1);
-            cv::drawContours(mask, std::vector<std::vector<cv::Point>>{contour}, 0, cv::Scalar(255), -1);
-            
-            cv::Mat overlay = cv::Mat::zeros(result.size(), result.type());
-            overlay.setTo(cv::Scalar(0, 0, 255), mask);
-            
-            cv::addWeighted(result, 1.0, overlay, 0.5, 0, result);
-            
-            cv::rectangle(result, boundingRect, cv::Scalar(0, 255, 0), 2);
-        }
+        cv::Rect boundingRect = cv::boundingRect(contour);
+        
+        cv::Mat mask = cv::Mat::zeros(boundingRect.size(), CV_8UC1);
+        cv::drawContours(mask, std::vector<std::vector<cv::Point>>{contour}, 0, cv::Scalar(255), -1,
+                         cv::LINE_8, cv::noArray(), INT_MAX, -boundingRect.tl());
+        
+        cv::Mat overlay = cv::Mat::zeros(boundingRect.size(), result.type());
+        overlay.setTo(cv::Scalar(0, 0, 255), mask);
+        
+        cv::Mat target = result(boundingRect);
+        cv::addWeighted(target, 1.0, overlay, 0.5, 0, target);
+        
+        cv::rectangle(result, boundingRect, cv::Scalar(0, 255, 0), 2);
     }
     
     // Collect bounding rectangles for merging
     std::vector<cv::Rect> boundingRects;
     for (const auto& contour : contours) {
-        if (cv::contourArea(contour) > 100) {
-            boundingRects.push_back(cv::boundingRect(contour));
-        }
+        boundingRects.push_back(cv::boundingRect(contour));
     }
 
     // Merge overlapping rectangles for cleaner visualization
-    std::vector<cv::Rect> mergedRects;
-    std::vector<bool> processed(boundingRects.size(), false);
+    std::vector<cv::Rect> mergedRects = mergeRegions(boundingRects, 0);
+
+    // Draw the merged rectangles
+    for (const auto& rect : mergedRects) {
+        cv::Mat overlay(rect.size(), result.type(), cv::Scalar(0, 0, 255));
+        
+        cv::Mat target = result(rect);
+        cv::addWeighted(target, 1.0, overlay, 0.5, 0, target);
+        
+        cv::rectangle(result, rect, cv::Scalar(0, 255, 0), 2);
+    }
 
-    for (size_t i = 0; i < boundingRects.size(); i++) {
+    return result;
+}
+
+// Wilson score interval for `changed` of `sampled` draws at z, narrowed by the finite
+// population correction since leaves are drawn without replacement from `total`
+static void wilsonInterval(size_t changed, size_t sampled, size_t total, double z, double& lower, double& upper) {
+    const double n = static_cast<double>(sampled);
+    const double p = changed / n;
+    const double z2 = z * z;
+    const double centre = (p + z2 / (2 * n)) / (1 + z2 / n);
+    double halfWidth = z / (1 + z2 / n) * std::sqrt(p * (1 - p) / n + z2 / (4 * n * n));
+    if (total > 1) {
+        halfWidth *= std::sqrt(static_cast<double>(total - sampled) / (total - 1));
+    }
+    lower = std::max(0.0, centre - halfWidth);
+    upper = std::min(1.0, centre + halfWidth);
+}
+
+// Draws leaves in a random order and compares them in small parallel batches, checking the
+// interval after each batch
+ChangeEstimate ImageComparer::estimateChange(const cv::Mat& image1, const cv::Mat& image2, double margin,
+                                             int minChunkSize, const cv::Rect& roi) {
+    if (image1.empty() || image2.empty()) {
+        throw std::runtime_error("One or both images are empty");
+    }
+    
+    cv::Rect area = comparisonArea(image1.size(), roi);
+    
+    cv::Mat first, resizedImage2;
+    prepareInputs(image1, image2, first, resizedImage2);
+    
+    std::vector<cv::Rect> regions = Quadtree::leafRegions(area.size(), minChunkSize);
+    for (auto& region : regions) {
+        region += area.tl();
+    }
+    std::shuffle(regions.begin(), regions.end(), std::mt19937(std::random_device{}()));
+    
+    const double z = 1.96;      // 95% confidence
+    const size_t minSamples = 30; // Below this the interval is not trusted
+    const size_t batchSize = static_cast<size_t>(std::max(8, cv::getNumThreads() * 4));
+    
+    ChangeEstimate estimate;
+    estimate.total = regions.size();
+    std::vector<char> changed;
+    if (regions.empty()) {
+        return estimate;
+    }
+    
+    while (estimate.sampled < estimate.total) {
+        size_t batch = std::min(batchSize, estimate.total - estimate.sampled);
+        changed.assign(batch, 0);
+        
+        // Same test as the stored leaf records: identical bytes, or else identical leaf hashes
+        cv::parallel_for_(cv::Range(0, static_cast<int>(batch)), [&](const cv::Range& range) {
+            for (int i = range.start; i < range.end; i++) {
+                const cv::Rect& region = regions[estimate.sampled + i];
+                cv::Mat tile1 = first(region);
+                cv::Mat tile2 = resizedImage2(region);
+                if (Utils::computeTileChecksum(tile1) == Utils::computeTileChecksum(tile2)) continue;
+                changed[i] = LeafHasher::hashTile(tile1) != LeafHasher::hashTile(tile2);
+            }
+        });
+        
+        estimate.sampled += batch;
+        estimate.changed += std::count(changed.begin(), changed.end(), 1);
+        
+        wilsonInterval(estimate.changed, estimate.sampled, estimate.total, z, estimate.lower, estimate.upper);
+        if (estimate.sampled >= minSamples && (estimate.upper - estimate.lower) / 2 <= margin) {
+            break;
+        }
+    }
+    
+    estimate.fraction = static_cast<double>(estimate.changed) / estimate.sampled;
+    if (estimate.sampled == estimate.total) {
+        estimate.lower = estimate.upper = estimate.fraction;
+    }
+    return estimate;
+}
+
+// The part of an image a comparison covers: all of it, or the ROI clipped to the image
+cv::Rect ImageComparer::comparisonArea(const cv::Size& imageSize, const cv::Rect& roi) {
+    cv::Rect bounds(0, 0, imageSize.width, imageSize.height);
+    if (roi.empty()) {
+        return bounds;
+    }
+    cv::Rect area = roi & bounds;
+    if (area.empty()) {
+        throw std::invalid_argument("The region of interest lies outside the image");
+    }
+    return area;
+}
+
+// Greedily merges rectangles that overlap once grown by `padding` pixels on every side
+std::vector<cv::Rect> ImageComparer::mergeRegions(const std::vector<cv::Rect>& regions, int padding) {
+    std::vector<cv::Rect> mergedRegions;
+    std::vector<bool> processed(regions.size(), false);
+    
+    for (size_t i = 0; i < regions.size(); i++) {
         if (processed[i]) continue;
         
-        cv::Rect current = boundingRects[i];
+        cv::Rect current = regions[i];
         processed[i] = true;
         
         bool changes;
         do {
             changes = false;
-            for (size_t j = 0; j < boundingRects.size(); j++) {
+            for (size_t j = 0; j < regions.size(); j++) {
                 if (processed[j]) continue;
                 
-                cv::Rect intersection = current & boundingRects[j];
-                if (!intersection.empty()) {
-                    current = current | boundingRects[j];
+                // Slightly expanded rectangle to detect nearby regions
+                cv::Rect expanded(
+                    current.x - padding, current.y - padding,
+                    current.width + 2 * padding, current.height + 2 * padding
+                );
+                
+                if ((expanded & regions[j]).area() > 0) {
+                    current = current | regions[j];
                     processed[j] = true;
                     changes = true;
                 }
             }
         } while (changes);
         
-        mergedRects.push_back(current);
-    }
-
-    // Draw the merged rectangles
-    for (const auto& rect : mergedRects) {
-        cv::Mat mask = cv::Mat::zeros(result.size(), CV_8UC1);
-        cv::rectangle(mask, rect, cv::Scalar(255), -1);
-        
-        cv::Mat overlay = cv::Mat::zeros(result.size(), result.type());
-        overlay.setTo(cv::Scalar(0, 0, 255), mask);
-        
-        cv::addWeighted(result, 1.0, overlay, 0.5, 0, result);
-        
-        cv::rectangle(result, rect, cv::Scalar(0, 255, 0), 2);
+        mergedRegions.push_back(current);
     }
-
-    return result;
+    
+    return mergedRegions;
 }
 
 // Check if two perceptual hashes are within a similarity threshold
@@ -144,171 +421,92 @@ bool ImageComparer::areHashesSimilar(const std::string& hash1, const std::string
 
 // Advanced comparison using Quadtree and MerkleTree structures
 // Uses a hybrid approach of structural comparison followed by pixel analysis
-std::vector<cv::Rect> ImageComparer::compareWithStructures(const cv::Mat& image1, const cv::Mat& image2, int minChunkSize, int sensitivity) {
+std::vector<cv::Rect> ImageComparer::compareWithStructures(const cv::Mat& image1, const cv::Mat& image2, int minChunkSize, int sensitivity,
+                                                           LeafComparisonStats* stats, const cv::Rect& roi, Progress* progress) {
     std::vector<cv::Rect> diffRegions;
+    cv::Rect area = comparisonArea(image1.size(), roi);
     
     try {
-        // Resize second image if dimensions don't match
-        cv::Mat resizedImage2;
-        if (image1.size() != image2.size()) {
-            cv::resize(image2, resizedImage2, image1.size());
-        } else {
-            resizedImage2 = image2;
-        }
+        // Resize second image if dimensions don't match, and bring both to one pixel format
+        cv::Mat first, resizedImage2;
+        prepareInputs(image1, image2, first, resizedImage2);
         
-        // Convert both images to grayscale
+        // Convert the compared area, plus a one-pixel halo for the blur, to grayscale at the
+        // images' own depth
+        cv::Rect outer = cv::Rect(area.x - 1, area.y - 1, area.width + 2, area.height + 2) &
+                         cv::Rect(0, 0, image1.cols, image1.rows);
         cv::Mat gray1, gray2;
-        if (image1.channels() == 3 || image1.channels() == 4) {
-            cv::cvtColor(image1, gray1, cv::COLOR_BGR2GRAY);
-        } else {
-            gray1 = image1.clone();
-        }
-        
-        if (resizedImage2.channels() == 3 || resizedImage2.channels() == 4) {
-            cv::cvtColor(resizedImage2, gray2, cv::COLOR_BGR2GRAY);
-        } else {
-            gray2 = resizedImage2.clone();
-        }
+        ImageProcessor::convertToGrayscale(first(outer), gray1);
+        ImageProcessor::convertToGrayscale(resizedImage2(outer), gray2);
         
         // Apply blur to reduce noise
         cv::GaussianBlur(gray1, gray1, cv::Size(3, 3), 0);
         cv::GaussianBlur(gray2, gray2, cv::Size(3, 3), 0);
         
-        // PHASE 1: Use Quadtree/Merkle Tree to identify suspect regions
-        Quadtree quadtree1(gray1, minChunkSize);
-        Quadtree quadtree2(gray2, minChunkSize);
+        // Drop the halo; thanks to it the area blurs exactly as it would in the whole image
+        cv::Rect inner(area.x - outer.x, area.y - outer.y, area.width, area.height);
+        gray1 = gray1(inner);
+        gray2 = gray2(inner);
         
-        std::vector<std::string> hashes1;
-        std::vector<std::string> hashes2;
-        std::map<std::string, cv::Rect> hashToRegion1;
-        std::map<std::string, cv::Rect> hashToRegion2;
+        // PHASE 1: Compare Quadtree leaves at the same position with a tiered comparator
+        // (raw checksum, then fast hash, then DCT perceptual hash) to identify suspect regions.
+        // The Quadtree covers only the compared area, so the work follows its size.
+        std::vector<cv::Rect> leafRegions = Quadtree::leafRegions(gray1.size(), minChunkSize);
+        std::vector<cv::Rect> suspectRegions;
+        LeafComparisonStats counts;
         
-        collectHashesWithRegions(quadtree1.getRoot(), hashes1, hashToRegion1);
-        collectHashesWithRegions(quadtree2.getRoot(), hashes2, hashToRegion2);
+        if (progress) progress->begin("Comparing leaves", leafRegions.size(), "tiles");
+        for (const auto& region : leafRegions) {
+            if (compareLeaf(gray1(region), gray2(region), sensitivity, counts) == LeafMatch::Different) {
+                suspectRegions.push_back(region);
+            }
+            if (progress) progress->step();
+        }
+        if (progress) progress->finish();
         
-        MerkleTree tree1(hashes1);
-        MerkleTree tree2(hashes2);
+        if (stats) {
+            *stats = counts;
+        }
         
         // Quick exit if images are identical
-        if (tree1.getRootHash() == tree2.getRootHash()) {
+        if (suspectRegions.empty()) {
             return diffRegions;
         }
         
-        // Create hash set for faster lookups
-        std::unordered_set<std::string> hashSet2;
-        for (const auto& hash : hashes2) {
-            hashSet2.insert(hash);
-        }
-        
-        // Find potentially different regions by comparing hashes
-        std::vector<cv::Rect> suspectRegions;
-        int similarityThreshold = sensitivity;
+        // PHASE 2: Refine suspect regions with pixel-level analysis, in parallel across regions.
+        // Each region writes only its own slot, and the slots are concatenated in region order,
+        // so the result does not depend on the thread count.
+        std::vector<std::vector<cv::Rect>> regionResults(suspectRegions.size());
+        AllocProfiler::Scope refineStage(AllocStage::Refine);
         
-        for (const auto& pair : hashToRegion1) {
-            const std::string& hash = pair.first;
-            const cv::Rect& region = pair.second;
-            
-            // Skip if exact match exists
-            if (hashSet2.find(hash) != hashSet2.end()) {
-                continue;
-            }
-            
-            // Check for similar hashes within threshold
-            bool foundSimilar = false;
-            for (const auto& h2 : hashes2) {
-                if (areHashesSimilar(hash, h2, similarityThreshold)) {
-                    foundSimilar = true;
-                    break;
-                }
-            }
-            
-            if (!foundSimilar) {
-                suspectRegions.push_back(region);
+        // Workers stop early once cancelled; the exception is raised here, on the calling thread
+        if (progress) progress->begin("Refining regions", suspectRegions.size(), "regions");
+        cv::parallel_for_(cv::Range(0, static_cast<int>(suspectRegions.size())), [&](const cv::Range& range) {
+            for (int i = range.start; i < range.end; i++) {
+                refineRegion(gray1, gray2, suspectRegions[i], regionResults[i]);
+                if (progress && !progress->advance()) break;
             }
+        });
+        if (progress) {
+            progress->throwIfCancelled();
+            progress->finish();
         }
         
-        // PHASE 2: Refine suspect regions with pixel-level analysis
-        for (const auto& region : suspectRegions) {
-            // Ensure region is within image bounds
-            cv::Rect safeRegion = region & cv::Rect(0, 0, gray1.cols, gray1.rows);
-            if (safeRegion.width <= 0 || safeRegion.height <= 0) continue;
-            
-            // Extract region from both images
-            cv::Mat region1 = gray1(safeRegion);
-            cv::Mat region2 = gray2(safeRegion);
-            
-            // Calculate pixel differences in this region
-            cv::Mat diffMap;
-            cv::absdiff(region1, region2, diffMap);
-            
-            cv::Mat thresholdedDiff;
-            cv::threshold(diffMap, thresholdedDiff, 45, 255, cv::THRESH_BINARY);
-            
-            // Clean up the difference map
-            cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-            cv::morphologyEx(thresholdedDiff, thresholdedDiff, cv::MORPH_CLOSE, kernel);
-            cv::morphologyEx(thresholdedDiff, thresholdedDiff, cv::MORPH_OPEN, kernel);
-            
-            // Find contours of actual differences
-            std::vector<std::vector<cv::Point>> contours;
-            cv::findContours(thresholdedDiff, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-            
-            // Add significant contours to difference regions
-            for (const auto& contour : contours) {
-                if (cv::contourArea(contour) > 25) {
-                    cv::Rect contourRect = cv::boundingRect(contour);
-                    // Translate back to original image coordinates
-                    contourRect.x += safeRegion.x;
-                    contourRect.y += safeRegion.y;
-                    diffRegions.push_back(contourRect);
-                }
-            }
-            
-            // If no significant contours, add small indicator
-            if (contours.empty()) {
-                int centerX = safeRegion.x + safeRegion.width/2 - 5;
-                int centerY = safeRegion.y + safeRegion.height/2 - 5;
-                diffRegions.push_back(cv::Rect(centerX, centerY, 10, 10));
+        // Regions were found relative to the area; report them in image coordinates
+        for (const auto& rects : regionResults) {
+            for (const auto& rect : rects) {
+                diffRegions.push_back(rect + area.tl());
             }
         }
         
         // Merge close or overlapping regions
         if (!diffRegions.empty()) {
-            std::vector<cv::Rect> mergedRegions;
-            std::vector<bool> processed(diffRegions.size(), false);
-            
-            for (size_t i = 0; i < diffRegions.size(); i++) {
-                if (processed[i]) continue;
-                
-                cv::Rect current = diffRegions[i];
-                processed[i] = true;
-                
-                bool changes;
-                do {
-                    changes = false;
-                    for (size_t j = 0; j < diffRegions.size(); j++) {
-                        if (processed[j]) continue;
-                        
-                        // Slightly expanded rectangle to detect nearby regions
-                        cv::Rect expanded(
-                            current.x - 5, current.y - 5,
-                            current.width + 10, current.height + 10
-                        );
-                        
-                        if ((expanded & diffRegions[j]).area() > 0) {
-                            current = current | diffRegions[j];
-                            processed[j] = true;
-                            changes = true;
-                        }
-                    }
-                } while (changes);
-                
-                mergedRegions.push_back(current);
-            }
-            
-            return mergedRegions;
+            return mergeRegions(diffRegions, 5);
         }
     }
+    catch (const OperationCancelled&) {
+        throw;
+    }
     catch (const std::exception& e) {
         std::cerr << "Error in compareWithStructures: " << e.what() << std::endl;
     }
@@ -316,28 +514,209 @@ std::vector<cv::Rect> ImageComparer::compareWithStructures(const cv::Mat& image1
     return diffRegions;
 }
 
-// Recursively collect perceptual hashes from quadtree leaf nodes
-void ImageComparer::collectHashesWithRegions(std::shared_ptr<QuadtreeNode> node, 
-                                          std::vector<std::string>& hashes, 
-                                          std::map<std::string, cv::Rect>& hashToRegion) {
-    if (!node) return;
-    
-    if (node->isLeaf()) {
-        std::string hash = hashImageChunk(node->chunk);
-        hashes.push_back(hash);
-        hashToRegion[hash] = node->region;
-    } else {
-        // Recursively process child nodes
-        collectHashesWithRegions(node->topLeft, hashes, hashToRegion);
-        collectHashesWithRegions(node->topRight, hashes, hashToRegion);
-        collectHashesWithRegions(node->bottomLeft, hashes, hashToRegion);
-        collectHashesWithRegions(node->bottomRight, hashes, hashToRegion);
+// Per-thread buffers for region refinement. They only ever grow, and each region works in
+// a view of them, so refining thousands of regions does not allocate per region.
+struct RefinementScratch {
+    cv::Mat diffBuffer;
+    cv::Mat thresholdBuffer;
+    std::vector<std::vector<cv::Point>> contours;
+};
+
+// 3x3 structuring element shared by every refinement thread
+const cv::Mat& ImageComparer::morphologyKernel() {
+    static const cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
+    return kernel;
+}
+
+// Pixel-level analysis of one suspect region; appends the differing areas to `out`
+void ImageComparer::refineRegion(const cv::Mat& gray1, const cv::Mat& gray2, const cv::Rect& region,
+                                 std::vector<cv::Rect>& out) {
+    thread_local RefinementScratch scratch;
+    
+    // Ensure region is within image bounds
+    cv::Rect safeRegion = region & cv::Rect(0, 0, gray1.cols, gray1.rows);
+    if (safeRegion.width <= 0 || safeRegion.height <= 0) return;
+    
+    // Extract region from both images
+    cv::Mat region1 = gray1(safeRegion);
+    cv::Mat region2 = gray2(safeRegion);
+    
+    // Calculate pixel differences in this region
+    cv::Mat diffMap = scratchView(scratch.diffBuffer, safeRegion.size(), gray1.type());
+    cv::absdiff(region1, region2, diffMap);
+    
+    // Same as THRESH_BINARY to 255, but the mask is 8-bit whatever the depth of the difference
+    cv::Mat thresholdedDiff = scratchView(scratch.thresholdBuffer, safeRegion.size());
+    cv::compare(diffMap, ImageProcessor::scaleThreshold(PIXEL_THRESHOLD, gray1.depth()), thresholdedDiff, cv::CMP_GT);
+    
+    // Clean up the difference map. The views are isolated so the morphology treats their
+    // edges as image borders, exactly as it would for a standalone Mat.
+    const int border = cv::BORDER_CONSTANT | cv::BORDER_ISOLATED;
+    cv::morphologyEx(thresholdedDiff, thresholdedDiff, cv::MORPH_CLOSE, morphologyKernel(),
+                     cv::Point(-1, -1), 1, border, cv::morphologyDefaultBorderValue());
+    cv::morphologyEx(thresholdedDiff, thresholdedDiff, cv::MORPH_OPEN, morphologyKernel(),
+                     cv::Point(-1, -1), 1, border, cv::morphologyDefaultBorderValue());
+    
+    // Find contours of actual differences
+    std::vector<std::vector<cv::Point>>& contours = scratch.contours;
+    contours.clear();
+    cv::findContours(thresholdedDiff, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    
+    // Add significant contours to difference regions
+    for (const auto& contour : contours) {
+        if (cv::contourArea(contour) > 25) {
+            cv::Rect contourRect = cv::boundingRect(contour);
+            // Translate back to original image coordinates
+            contourRect.x += safeRegion.x;
+            contourRect.y += safeRegion.y;
+            out.push_back(contourRect);
+        }
+    }
+    
+    // If no significant contours, add small indicator
+    if (contours.empty()) {
+        int centerX = safeRegion.x + safeRegion.width/2 - 5;
+        int centerY = safeRegion.y + safeRegion.height/2 - 5;
+        out.push_back(cv::Rect(centerX, centerY, 10, 10));
+    }
+}
+
+// Tiered comparison of two leaves at the same position; each tier runs only if the cheaper one
+// could not show the leaves are the same
+ImageComparer::LeafMatch ImageComparer::compareLeaf(const cv::Mat& leaf1, const cv::Mat& leaf2,
+                                                    int threshold, LeafComparisonStats& stats) {
+    // Tier 1: byte-identical tiles
+    if (Utils::computeTileChecksum(leaf1) == Utils::computeTileChecksum(leaf2)) {
+        stats.checksumMatches++;
+        return LeafMatch::Checksum;
+    }
+    
+    // Tier 2: coarse 16x16 mean hash
+    if (fastHashChunk(leaf1, stats) == fastHashChunk(leaf2, stats)) {
+        stats.fastHashMatches++;
+        return LeafMatch::FastHash;
     }
+    
+    // Tier 3: DCT perceptual hash within the similarity threshold
+    if (areHashesSimilar(hashImageChunk(leaf1, stats), hashImageChunk(leaf2, stats), threshold)) {
+        stats.perceptualMatches++;
+        return LeafMatch::PerceptualHash;
+    }
+    
+    stats.mismatches++;
+    return LeafMatch::Different;
 }
 
 // Generate perceptual hash for an image chunk
-std::string ImageComparer::hashImageChunk(const cv::Mat& chunk) {
-    return Utils::computePerceptualHash(chunk);
+std::string ImageComparer::hashImageChunk(const cv::Mat& chunk, LeafComparisonStats& stats) {
+    bool usedKernel = false;
+    std::string hash = LeafHasher::hashTile(chunk, &usedKernel);
+    stats.tileHashes++;
+    if (usedKernel) stats.kernelHashes++;
+    return hash;
+}
+
+// Generate the coarse fast hash for an image chunk
+std::string ImageComparer::fastHashChunk(const cv::Mat& chunk, LeafComparisonStats& stats) {
+    std::string hash;
+    stats.tileHashes++;
+    if (TileKernels::fastHash(chunk, hash)) {
+        stats.kernelHashes++;
+        return hash;
+    }
+    return Utils::computeFastHash(chunk);
+}
+
+// Half of the score comes from the global hash, half from the per-cell hashes
+double ImageComparer::signatureSimilarity(const VersionSignature& a, const VersionSignature& b) {
+    const double globalDistance = Utils::popcount64(a.globalHash ^ b.globalHash) / 64.0;
+    
+    const size_t cells = std::min(a.gridHashes.size(), b.gridHashes.size());
+    const int cellBits = Utils::xorPopcount(a.gridHashes.data(), b.gridHashes.data(), cells);
+    const double gridDistance = cells > 0 ? cellBits / (64.0 * cells) : globalDistance;
+    
+    return 1.0 - 0.5 * (globalDistance + gridDistance);
+}
+
+// All-pairs similarity; each row of the upper triangle is an independent task
+cv::Mat ImageComparer::similarityMatrix(const std::vector<VersionSignature>& signatures) {
+    const int n = static_cast<int>(signatures.size());
+    cv::Mat matrix(n, n, CV_32F, cv::Scalar(1.0));
+    
+    cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            for (int j = i + 1; j < n; j++) {
+                float similarity = static_cast<float>(signatureSimilarity(signatures[i], signatures[j]));
+                matrix.at<float>(i, j) = similarity;
+                matrix.at<float>(j, i) = similarity;
+            }
+        }
+    });
+    
+    return matrix;
+}
+
+// Same regions as compareImages, for callers that only need the rectangles
+std::vector<cv::Rect> ImageComparer::findDifferenceRegions(const cv::Mat& image1, const cv::Mat& image2, int sensitivity,
+                                                           const cv::Rect& roi) {
+    if (image1.empty() || image2.empty()) {
+        throw std::runtime_error("One or both images are empty");
+    }
+    
+    cv::Rect area = comparisonArea(image1.size(), roi);
+    std::vector<cv::Rect> boundingRects;
+    for (const auto& contour : significantContours(image1, image2, sensitivity, area)) {
+        boundingRects.push_back(cv::boundingRect(contour));
+    }
+    return mergeRegions(boundingRects, 0);
+}
+
+// Difference contours above the minimum size, built in horizontal stripes across all cores
+std::vector<std::vector<cv::Point>> ImageComparer::significantContours(const cv::Mat& image1, const cv::Mat& image2,
+                                                                       int sensitivity, const cv::Rect& area) {
+    // Resize second image if dimensions don't match, and bring both to one pixel format
+    cv::Mat first, resizedImage2;
+    prepareInputs(image1, image2, first, resizedImage2);
+    
+    std::vector<std::vector<cv::Point>> contours = findDifferenceContours(first, resizedImage2, sensitivity, area);
+    contours.erase(std::remove_if(contours.begin(), contours.end(), [](const std::vector<cv::Point>& contour) {
+        return cv::contourArea(contour) <= 100;
+    }), contours.end());
+    return contours;
+}
+
+// Scores regions in parallel; each region fills only its own slot
+std::vector<DiffRegion> ImageComparer::scoreRegions(const cv::Mat& image1, const cv::Mat& image2,
+                                                    const std::vector<cv::Rect>& regions, int threshold) {
+    cv::Mat first, resizedImage2;
+    prepareInputs(image1, image2, first, resizedImage2);
+    const int pixelThreshold = ImageProcessor::scaleThreshold(threshold, first.depth());
+    const double maxValue = ImageProcessor::maxValue(first.depth());
+    
+    std::vector<DiffRegion> scored(regions.size());
+    cv::parallel_for_(cv::Range(0, static_cast<int>(regions.size())), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            scored[i].rect = regions[i];
+            cv::Rect safeRegion = regions[i] & cv::Rect(0, 0, image1.cols, image1.rows);
+            if (safeRegion.empty()) continue;
+            
+            cv::Mat gray1, gray2;
+            if (first.channels() == 1) {
+                gray1 = first(safeRegion);
+                gray2 = resizedImage2(safeRegion);
+            } else {
+                ImageProcessor::convertToGrayscale(first(safeRegion), gray1);
+                ImageProcessor::convertToGrayscale(resizedImage2(safeRegion), gray2);
+            }
+            
+            cv::Mat diff, changed;
+            cv::absdiff(gray1, gray2, diff);
+            cv::compare(diff, pixelThreshold, changed, cv::CMP_GT);
+            scored[i].meanDifference = cv::mean(diff)[0] / maxValue;
+            scored[i].changedFraction = static_cast<double>(cv::countNonZero(changed)) / safeRegion.area();
+        }
+    });
+    return scored;
 }
 
 // Save difference visualization to file
@@ -359,19 +738,23 @@ void ImageComparer::highlightDifferences(const cv::Mat& image, const std::vector
     }
     
     cv::Mat result;
-    if (image.channels() == 1) {
-        cv::cvtColor(image, result, cv::COLOR_GRAY2BGR);
-    } else {
+    if (image.type() == CV_8UC3) {
         image.copyTo(result);
+    } else {
+        result = ImageProcessor::toDisplay(image);
     }
     
     // Apply transparent red overlay and green rectangle for each difference region
     for (const auto& region : diffRegions) {
-        cv::Mat overlay = result(region).clone();
+        // Merged regions can reach past the image edge
+        cv::Rect safeRegion = region & cv::Rect(0, 0, result.cols, result.rows);
+        if (safeRegion.width <= 0 || safeRegion.height <= 0) continue;
+        
+        cv::Mat overlay = result(safeRegion).clone();
         cv::addWeighted(overlay, 0.5, cv::Scalar(0, 0, 255), 0.5, 0, overlay);
-        overlay.copyTo(result(region));
+        overlay.copyTo(result(safeRegion));
         
-        cv::rectangle(result, region, cv::Scalar(0, 255, 0), 2);
+        cv::rectangle(result, safeRegion, cv::Scalar(0, 255, 0), 2);
     }
     
     if (!cv::imwrite(outputPath, result)) {
@@ -6,20 +6,92 @@
 #include <vector>
 #include <map>
 #include "Quadtree.h"
+#include "HashStore.h"
+#include "Progress.h"
+
+// How many leaves each tier of the advanced comparison resolved
+struct LeafComparisonStats {
+    size_t checksumMatches = 0;   // Byte-identical tiles
+    size_t fastHashMatches = 0;   // Resolved by Utils::computeFastHash
+    size_t perceptualMatches = 0; // Resolved by the DCT perceptual hash within the threshold
+    size_t mismatches = 0;        // Passed on to pixel-level refinement
+    size_t tileHashes = 0;        // Fast and perceptual hashes computed for the tiers above
+    size_t kernelHashes = 0;      // Of those, hashes computed by the compile-time TileKernels
+};
+
+// Sampled estimate of the share of leaves whose hash differs between two images
+struct ChangeEstimate {
+    double fraction = 0.0;  // Changed share of the sampled leaves
+    double lower = 0.0;     // Bounds of the confidence interval
+    double upper = 0.0;
+    size_t sampled = 0;     // Leaves compared
+    size_t changed = 0;     // Of those, leaves whose hash differed
+    size_t total = 0;       // Leaves in the layout
+};
+
+// A merged difference region with how strongly it changed
+struct DiffRegion {
+    cv::Rect rect;
+    double meanDifference = 0.0;   // Mean absolute grayscale difference, 0-1
+    double changedFraction = 0.0;  // Share of its pixels differing by more than the threshold
+};
 
 class ImageComparer {
 public:
-    static cv::Mat compareImages(const cv::Mat& image1, const cv::Mat& image2, int sensitivity = 65);
+    // Grayscale difference at which structural refinement counts a pixel as changed, in 8-bit
+    // units (scaled for 16-bit images like every pixel threshold)
+    static constexpr int PIXEL_THRESHOLD = 45;
+
+    // A non-empty roi restricts the comparison to that rectangle; results stay in image coordinates
+    static cv::Mat compareImages(const cv::Mat& image1, const cv::Mat& image2, int sensitivity = 65,
+                                 const cv::Rect& roi = cv::Rect());
     static void visualizeDifferences(const cv::Mat& differences, const std::string& outputPath);
+    // The merged rectangles compareImages highlights, without rendering anything
+    static std::vector<cv::Rect> findDifferenceRegions(const cv::Mat& image1, const cv::Mat& image2, int sensitivity = 65,
+                                                       const cv::Rect& roi = cv::Rect());
+    // Scores each region; image2 is resized to image1 when their sizes differ
+    static std::vector<DiffRegion> scoreRegions(const cv::Mat& image1, const cv::Mat& image2,
+                                                const std::vector<cv::Rect>& regions, int threshold);
     
-    static std::vector<cv::Rect> compareWithStructures(const cv::Mat& image1, const cv::Mat& image2, int minChunkSize, int sensitivity = 10);
+    // Leaf comparison and refinement each report a `progress` stage; cancellation is
+    // rethrown as OperationCancelled
+    static std::vector<cv::Rect> compareWithStructures(const cv::Mat& image1, const cv::Mat& image2, int minChunkSize, int sensitivity = 10,
+                                                       LeafComparisonStats* stats = nullptr, const cv::Rect& roi = cv::Rect(),
+                                                       Progress* progress = nullptr);
     static void highlightDifferences(const cv::Mat& image, const std::vector<cv::Rect>& diffRegions, const std::string& outputPath);
+    // Samples random leaves until the 95% confidence interval of the changed share is within
+    // +/- `margin` (or every leaf has been seen); a leaf counts as changed when its leaf hash differs
+    static ChangeEstimate estimateChange(const cv::Mat& image1, const cv::Mat& image2, double margin,
+                                         int minChunkSize = 16, const cv::Rect& roi = cv::Rect());
+    // Merges rectangles that overlap or lie within `padding` pixels of each other
+    static std::vector<cv::Rect> mergeRegions(const std::vector<cv::Rect>& regions, int padding);
+    
+    // Similarity in [0, 1] from stored signatures (1 = same global and per-cell hashes)
+    static double signatureSimilarity(const VersionSignature& a, const VersionSignature& b);
+    // Symmetric CV_32F matrix of signatureSimilarity for every pair, computed across all cores
+    static cv::Mat similarityMatrix(const std::vector<VersionSignature>& signatures);
 private:
+    enum class LeafMatch { Checksum, FastHash, PerceptualHash, Different };
+
+    // Core size and halo of the tiles used by computeDifferenceMask
+    static constexpr int MASK_TILE = 256;
+    static constexpr int MASK_HALO = 5;
+    // Smallest stripe height worth a task of its own in findDifferenceContours
+    static constexpr int MIN_STRIPE_ROWS = 64;
+
     // Helper methods
-    static void collectHashesWithRegions(std::shared_ptr<QuadtreeNode> node, 
-                                        std::vector<std::string>& hashes, 
-                                        std::map<std::string, cv::Rect>& hashToRegion);
-    static std::string hashImageChunk(const cv::Mat& chunk);
+    static void computeDifferenceMask(const cv::Mat& image1, const cv::Mat& image2, int sensitivity,
+                                      const cv::Rect& area, cv::Mat& mask);
+    static std::vector<std::vector<cv::Point>> findDifferenceContours(const cv::Mat& image1, const cv::Mat& image2, int sensitivity,
+                                                                      const cv::Rect& area);
+    static std::vector<std::vector<cv::Point>> significantContours(const cv::Mat& image1, const cv::Mat& image2, int sensitivity,
+                                                                   const cv::Rect& area);
+    static cv::Rect comparisonArea(const cv::Size& imageSize, const cv::Rect& roi);
+    static void refineRegion(const cv::Mat& gray1, const cv::Mat& gray2, const cv::Rect& region, std::vector<cv::Rect>& out);
+    static const cv::Mat& morphologyKernel();
+    static LeafMatch compareLeaf(const cv::Mat& leaf1, const cv::Mat& leaf2, int threshold, LeafComparisonStats& stats);
+    static std::string hashImageChunk(const cv::Mat& chunk, LeafComparisonStats& stats);
+    static std::string fastHashChunk(const cv::Mat& chunk, LeafComparisonStats& stats);
     static bool areHashesSimilar(const std::string& hash1, const std::string& hash2, int threshold);
 };
 
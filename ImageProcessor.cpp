@@ -3,14 +3,151 @@
 #include <opencv2/imgproc.hpp>
 #include <stdexcept>
 #include <opencv2/opencv.hpp>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
 
-// Reads an image from the given file path
+static uint32_t readUnsigned(const uchar* data, int bytes, bool littleEndian) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= static_cast<uint32_t>(data[littleEndian ? i : bytes - 1 - i]) << (8 * i);
+    }
+    return value;
+}
+
+// Orientation tag (1-8) of a TIFF-structured EXIF block; 1 when there is none
+static int tiffOrientation(const uchar* data, size_t size) {
+    if (size < 8 || !((data[0] == 'I' && data[1] == 'I') || (data[0] == 'M' && data[1] == 'M'))) {
+        return 1;
+    }
+    const bool little = data[0] == 'I';
+    if (readUnsigned(data + 2, 2, little) != 42) {
+        return 1;
+    }
+    size_t ifd = readUnsigned(data + 4, 4, little);
+    if (ifd + 2 > size) {
+        return 1;
+    }
+    const size_t count = readUnsigned(data + ifd, 2, little);
+    for (size_t i = 0; i < count && ifd + 2 + 12 * (i + 1) <= size; i++) {
+        const uchar* entry = data + ifd + 2 + 12 * i;
+        if (readUnsigned(entry, 2, little) == 0x0112) {
+            int orientation = static_cast<int>(readUnsigned(entry + 8, 2, little));
+            return orientation >= 1 && orientation <= 8 ? orientation : 1;
+        }
+    }
+    return 1;
+}
+
+// EXIF orientation of an encoded JPEG, PNG, WebP or TIFF file; 1 when it has none
+static int exifOrientation(const std::vector<uchar>& file) {
+    const uchar* data = file.data();
+    const size_t size = file.size();
+
+    if (size >= 4 && data[0] == 0xFF && data[1] == 0xD8) {
+        // JPEG: APP1 "Exif" segment before the scan data
+        size_t pos = 2;
+        while (pos + 4 <= size && data[pos] == 0xFF) {
+            const uchar marker = data[pos + 1];
+            if (marker == 0xFF) {
+                pos++;
+                continue;
+            }
+            if (marker == 0xDA || marker == 0xD9) {
+                break;
+            }
+            const size_t length = readUnsigned(data + pos + 2, 2, false);
+            if (marker == 0xE1 && length >= 8 && pos + 2 + length <= size &&
+                std::memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+                return tiffOrientation(data + pos + 10, length - 8);
+            }
+            pos += 2 + length;
+        }
+    } else if (size >= 8 && std::memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0) {
+        // PNG: eXIf chunk
+        size_t pos = 8;
+        while (pos + 8 <= size) {
+            const size_t length = readUnsigned(data + pos, 4, false);
+            if (length > size - pos - 8) {
+                break;
+            }
+            if (std::memcmp(data + pos + 4, "eXIf", 4) == 0) {
+                return tiffOrientation(data + pos + 8, length);
+            }
+            if (std::memcmp(data + pos + 4, "IEND", 4) == 0) {
+                break;
+            }
+            pos += 12 + length;
+        }
+    } else if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+        // WebP: EXIF chunk, sometimes with the JPEG "Exif" prefix kept
+        size_t pos = 12;
+        while (pos + 8 <= size) {
+            const size_t length = readUnsigned(data + pos + 4, 4, true);
+            if (length > size - pos - 8) {
+                break;
+            }
+            if (std::memcmp(data + pos, "EXIF", 4) == 0) {
+                const uchar* exif = data + pos + 8;
+                if (length >= 6 && std::memcmp(exif, "Exif\0\0", 6) == 0) {
+                    return tiffOrientation(exif + 6, length - 6);
+                }
+                return tiffOrientation(exif, length);
+            }
+            pos += 8 + length + (length & 1);
+        }
+    } else {
+        // TIFF: the tag is in the file's own first IFD
+        return tiffOrientation(data, size);
+    }
+    return 1;
+}
+
+// Same transforms as OpenCV applies when it is allowed to honour the tag
+static void applyOrientation(cv::Mat& image, int orientation) {
+    switch (orientation) {
+        case 2: cv::flip(image, image, 1); break;
+        case 3: cv::flip(image, image, -1); break;
+        case 4: cv::flip(image, image, 0); break;
+        case 5: cv::transpose(image, image); break;
+        case 6: cv::transpose(image, image); cv::flip(image, image, 1); break;
+        case 7: cv::flip(image, image, -1); cv::transpose(image, image); break;
+        case 8: cv::transpose(image, image); cv::flip(image, image, 0); break;
+        default: break;
+    }
+}
+
+// Reads an image from the given file path, keeping its bit depth, alpha and grayscale layout.
+// IMREAD_UNCHANGED is the only mode that keeps alpha, and OpenCV skips the EXIF orientation
+// in that mode, so the tag is read from the same bytes and applied here.
 cv::Mat ImageProcessor::readImage(const std::string& filePath) {
-    cv::Mat image = cv::imread(filePath, cv::IMREAD_COLOR);
+    std::ifstream infile(filePath, std::ios::binary);
+    std::vector<uchar> encoded((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+    cv::Mat image;
+    if (!encoded.empty()) {
+        image = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);
+    }
     if (image.empty()) {
         throw std::runtime_error("Failed to read image from: " + filePath);
     }
+    applyOrientation(image, exifOrientation(encoded));
+
+    if (image.channels() != 1 && image.channels() != 3 && image.channels() != 4) {
+        throw std::runtime_error("Unsupported image with " + std::to_string(image.channels()) +
+                                 " channels: " + filePath);
+    }
+
+    // Floating point sources (0..1) are the only ones converted; 16 bits keep their precision
+    // far better than 8 would
+    if (image.depth() == CV_32F || image.depth() == CV_64F) {
+        cv::Mat converted;
+        image.convertTo(converted, CV_MAKETYPE(CV_16U, image.channels()), maxValue(CV_16U));
+        image = converted;
+    } else if (image.depth() != CV_8U && image.depth() != CV_16U) {
+        throw std::runtime_error("Unsupported signed pixel depth in: " + filePath);
+    }
     return image;
 }
 
@@ -21,10 +158,94 @@ cv::Mat ImageProcessor::convertToGrayscale(const cv::Mat& image) {
     }
 
     cv::Mat grayImage;
-    cv::cvtColor(image, grayImage, cv::COLOR_BGR2GRAY);
+    convertToGrayscale(image, grayImage);
     return grayImage;
 }
 
+// Blends the luma of a BGRA image over a mid-gray background by its alpha, so an edit that
+// only changes transparency still changes the grayscale image. Opaque pixels are left as is.
+template <typename T>
+static void compositeAlpha(const cv::Mat& bgra, cv::Mat& gray) {
+    const uint32_t max = std::numeric_limits<T>::max();
+    const uint32_t background = (max + 1) / 2;
+    for (int row = 0; row < gray.rows; row++) {
+        const T* in = bgra.ptr<T>(row);
+        T* out = gray.ptr<T>(row);
+        for (int col = 0; col < gray.cols; col++) {
+            const uint32_t alpha = in[4 * col + 3];
+            if (alpha != max) {
+                out[col] = static_cast<T>((out[col] * alpha + background * (max - alpha) + max / 2) / max);
+            }
+        }
+    }
+}
+
+void ImageProcessor::convertToGrayscale(const cv::Mat& image, cv::Mat& gray) {
+    switch (image.channels()) {
+        case 1: image.copyTo(gray); break;
+        case 3: cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY); break;
+        case 4:
+            cv::cvtColor(image, gray, cv::COLOR_BGRA2GRAY);
+            if (image.depth() == CV_16U) {
+                compositeAlpha<ushort>(image, gray);
+            } else {
+                compositeAlpha<uchar>(image, gray);
+            }
+            break;
+        default:
+            throw std::runtime_error("Unsupported image format with " +
+                                     std::to_string(image.channels()) + " channels");
+    }
+}
+
+cv::Mat ImageProcessor::toDisplay(const cv::Mat& image) {
+    cv::Mat display = image;
+    if (display.depth() != CV_8U) {
+        cv::Mat scaled;
+        display.convertTo(scaled, CV_MAKETYPE(CV_8U, display.channels()), maxValue(CV_8U) / maxValue(display.depth()));
+        display = scaled;
+    }
+
+    if (display.channels() == 1 || display.channels() == 4) {
+        cv::Mat bgr;
+        cv::cvtColor(display, bgr, display.channels() == 1 ? cv::COLOR_GRAY2BGR : cv::COLOR_BGRA2BGR);
+        display = bgr;
+    }
+    return display;
+}
+
+// Widening only: 8-bit values are scaled up to 16 bits, grayscale is expanded to colour and
+// a missing alpha channel is filled as opaque
+void ImageProcessor::matchFormats(cv::Mat& image1, cv::Mat& image2) {
+    const int depth = std::max(image1.depth(), image2.depth());
+    const int channels = std::max(image1.channels(), image2.channels());
+
+    for (cv::Mat* image : {&image1, &image2}) {
+        if (image->depth() != depth) {
+            cv::Mat converted;
+            image->convertTo(converted, CV_MAKETYPE(depth, image->channels()),
+                             maxValue(depth) / maxValue(image->depth()));
+            *image = converted;
+        }
+        if (image->channels() != channels) {
+            cv::Mat expanded;
+            int code = image->channels() == 3 ? cv::COLOR_BGR2BGRA
+                     : channels == 4          ? cv::COLOR_GRAY2BGRA
+                                              : cv::COLOR_GRAY2BGR;
+            cv::cvtColor(*image, expanded, code);
+            *image = expanded;
+        }
+    }
+}
+
+double ImageProcessor::maxValue(int depth) {
+    return depth == CV_16U ? 65535.0 : 255.0;
+}
+
+int ImageProcessor::scaleThreshold(int threshold, int depth) {
+    return depth == CV_16U ? threshold * 257 : threshold;
+}
+
 // Processes a specific region (ROI) of an image
 cv::Mat processImage(const cv::Mat& image, const cv::Rect& roi) {
     // Ensure the image is valid
@@ -4,10 +4,28 @@
 #include <string>
 #include <opencv2/opencv.hpp>
 
+// Images go through the pipeline at their native format: 8- or 16-bit unsigned depth with
+// 1 (grayscale), 3 (BGR) or 4 (BGRA) channels. Pixel thresholds are given in 8-bit units
+// and scaled to the image depth.
 class ImageProcessor {
 public:
+    // Decodes without conversion, upright according to the EXIF orientation; only formats
+    // outside the list above are converted
     static cv::Mat readImage(const std::string& filePath);
     static cv::Mat convertToGrayscale(const cv::Mat& image);
+    // Luma at the image's own depth, written into `gray` (reused when it already fits).
+    // Transparent pixels are blended towards mid-gray, so alpha edits show up in the luma.
+    static void convertToGrayscale(const cv::Mat& image, cv::Mat& gray);
+
+    // 8-bit BGR copy for drawing, JPEG previews and display; 8-bit BGR input is returned as is
+    static cv::Mat toDisplay(const cv::Mat& image);
+    // Brings both images to the deeper depth and the larger channel count of the two
+    static void matchFormats(cv::Mat& image1, cv::Mat& image2);
+
+    // Largest value of a pixel of this depth (255 or 65535)
+    static double maxValue(int depth);
+    // An 8-bit threshold expressed at this depth
+    static int scaleThreshold(int threshold, int depth);
 };
 
-#endif // IMAGEPROCESSOR_H
\ No newline at end of file
+#endif // IMAGEPROCESSOR_H
@@ -0,0 +1,170 @@
+#include "LeafHasher.h"
+#include "Quadtree.h"
+#include "Utils.h"
+#include "MerkleTree.h"
+#include "TileKernels.h"
+#include "AllocProfiler.h"
+#include <algorithm>
+#include <stdexcept>
+
+// Hashes every leaf of the Quadtree layout for this image
+std::vector<std::string> LeafHasher::hashLeaves(const cv::Mat& image, int minSize) {
+    if (image.empty() || image.cols <= 0 || image.rows <= 0) {
+        throw std::runtime_error("Invalid image dimensions for leaf hashing");
+    }
+
+    return hashLeaves(image, Quadtree::leafRegions(image.size(), minSize));
+}
+
+// Hashes the given leaf regions in order
+std::vector<std::string> LeafHasher::hashLeaves(const cv::Mat& image, const std::vector<cv::Rect>& regions,
+                                                Progress* progress) {
+    std::vector<std::string> hashes;
+    hashes.reserve(regions.size());
+
+    for (const auto& region : regions) {
+        // A view, not a copy: the tile is read directly from the decoded buffer
+        hashes.push_back(hashTile(image(region)));
+        if (progress) progress->step();
+    }
+
+    return hashes;
+}
+
+// Hashes one tile; grayscale conversion, blur and resize all reuse per-thread buffers
+std::string LeafHasher::hashTile(const cv::Mat& tile, bool* usedKernel) {
+    thread_local PerceptualHashScratch scratch;
+
+    // Tiles up to 64x64 go through the compile-time pipeline
+    std::string hash;
+    bool kernel = TileKernels::perceptualHash(tile, scratch, hash);
+    if (usedKernel) *usedKernel = kernel;
+    if (kernel) {
+        return hash;
+    }
+    return Utils::computePerceptualHash(tile, scratch);
+}
+
+// Hashes every leaf and builds the Merkle Tree over them
+VersionHashes LeafHasher::buildRecord(const cv::Mat& image, int minSize, Progress* progress) {
+    if (image.empty() || image.cols <= 0 || image.rows <= 0) {
+        throw std::runtime_error("Invalid image dimensions for leaf hashing");
+    }
+
+    VersionHashes record;
+    record.imageSize = image.size();
+    record.minSize = minSize;
+    record.regions = Quadtree::leafRegions(image.size(), minSize);
+    record.checksums.reserve(record.regions.size());
+
+    for (const auto& region : record.regions) {
+        record.checksums.push_back(Utils::computeTileChecksum(image(region)));
+    }
+    if (progress) progress->begin("Hashing tiles", record.regions.size(), "tiles");
+    record.leafHashes = hashLeaves(image, record.regions, progress);
+    if (progress) progress->finish();
+
+    AllocProfiler::Scope stage(AllocStage::Merkle);
+    record.merkleLevels = MerkleTree(record.leafHashes, progress).getLevels();
+
+    return record;
+}
+
+// Reuses the parent's hashes wherever the raw tile bytes are unchanged
+VersionHashes LeafHasher::buildRecordIncremental(const cv::Mat& image, int minSize,
+                                                 const VersionHashes& parent, size_t* rehashed,
+                                                 Progress* progress) {
+    if (image.empty() || image.cols <= 0 || image.rows <= 0) {
+        throw std::runtime_error("Invalid image dimensions for leaf hashing");
+    }
+
+    // Leaf indices only line up when the layout is the same
+    if (parent.imageSize != image.size() || parent.minSize != minSize ||
+        parent.checksums.size() != parent.leafHashes.size() || parent.merkleLevels.empty()) {
+        VersionHashes record = buildRecord(image, minSize, progress);
+        if (rehashed) *rehashed = record.leafHashes.size();
+        return record;
+    }
+
+    VersionHashes record;
+    record.imageSize = parent.imageSize;
+    record.minSize = minSize;
+    record.regions = parent.regions;
+    record.checksums.resize(record.regions.size());
+    record.leafHashes = parent.leafHashes;
+
+    std::vector<size_t> dirtyIndices;
+    std::vector<std::string> dirtyHashes;
+    size_t changedTiles = 0;
+
+    if (progress) progress->begin("Hashing changed tiles", record.regions.size(), "tiles");
+    for (size_t i = 0; i < record.regions.size(); i++) {
+        cv::Mat tile = image(record.regions[i]);
+        record.checksums[i] = Utils::computeTileChecksum(tile);
+
+        if (record.checksums[i] != parent.checksums[i]) {
+            changedTiles++;
+            record.leafHashes[i] = hashTile(tile);
+            if (record.leafHashes[i] != parent.leafHashes[i]) {
+                dirtyIndices.push_back(i);
+                dirtyHashes.push_back(record.leafHashes[i]);
+            }
+        }
+        if (progress) progress->step();
+    }
+    if (progress) progress->finish();
+
+    // Only the dirty paths are rehashed, which is quick enough not to need a stage of its own
+    AllocProfiler::Scope stage(AllocStage::Merkle);
+    MerkleTree tree(parent.merkleLevels);
+    tree.updateLeaves(dirtyIndices, dirtyHashes);
+    record.merkleLevels = tree.getLevels();
+
+    if (rehashed) *rehashed = changedTiles;
+    return record;
+}
+
+// Downscaling first keeps the full-resolution pass to one area resize; grayscale conversion
+// and blur then run on at most SIGNATURE_SIZE x SIGNATURE_SIZE pixels
+const cv::Mat& LeafHasher::signatureImage(const cv::Mat& image, cv::Mat& buffer) {
+    if (image.cols <= SIGNATURE_SIZE && image.rows <= SIGNATURE_SIZE) {
+        return image;
+    }
+    cv::resize(image, buffer, cv::Size(std::min(image.cols, SIGNATURE_SIZE), std::min(image.rows, SIGNATURE_SIZE)),
+               0, 0, cv::INTER_AREA);
+    return buffer;
+}
+
+uint64_t LeafHasher::globalHash(const cv::Mat& image) {
+    if (image.empty()) {
+        throw std::runtime_error("Empty image provided for a version signature");
+    }
+    cv::Mat buffer;
+    return Utils::packHash(hashTile(signatureImage(image, buffer)));
+}
+
+// Hashes the whole image and each cell of a fixed grid over it, from the downscaled copy
+VersionSignature LeafHasher::buildSignature(const cv::Mat& fullImage) {
+    if (fullImage.empty() || fullImage.cols < VersionSignature::GRID || fullImage.rows < VersionSignature::GRID) {
+        throw std::runtime_error("Image too small for a version signature");
+    }
+
+    cv::Mat buffer;
+    const cv::Mat& image = signatureImage(fullImage, buffer);
+
+    VersionSignature signature;
+    signature.globalHash = Utils::packHash(hashTile(image));
+    signature.gridHashes.reserve(VersionSignature::GRID * VersionSignature::GRID);
+
+    for (int row = 0; row < VersionSignature::GRID; row++) {
+        int y0 = row * image.rows / VersionSignature::GRID;
+        int y1 = (row + 1) * image.rows / VersionSignature::GRID;
+        for (int col = 0; col < VersionSignature::GRID; col++) {
+            int x0 = col * image.cols / VersionSignature::GRID;
+            int x1 = (col + 1) * image.cols / VersionSignature::GRID;
+            signature.gridHashes.push_back(Utils::packHash(hashTile(image(cv::Rect(x0, y0, x1 - x0, y1 - y0)))));
+        }
+    }
+
+    return signature;
+}
@@ -0,0 +1,50 @@
+#ifndef LEAFHASHER_H
+#define LEAFHASHER_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "HashStore.h"
+#include "Progress.h"
+
+// Ingest kernel for the add path: hashes Quadtree leaves straight from the decoded
+// BGR buffer. Luma is computed per tile into reusable scratch buffers, so no full-frame
+// grayscale copy or per-node clone is ever made. Produces the same leaf hashes as
+// building a Quadtree over ImageProcessor::convertToGrayscale() and hashing its leaves.
+class LeafHasher {
+public:
+    static std::vector<std::string> hashLeaves(const cv::Mat& image, int minSize);
+    // `progress`, when given, is advanced once per leaf and checked for cancellation
+    static std::vector<std::string> hashLeaves(const cv::Mat& image, const std::vector<cv::Rect>& regions,
+                                               Progress* progress = nullptr);
+
+    // Perceptual hash of a single BGR or grayscale tile (a view into the decoded image).
+    // `usedKernel`, when given, is set if a compile-time TileKernels instance produced it.
+    static std::string hashTile(const cv::Mat& tile, bool* usedKernel = nullptr);
+
+    // Full hash record (leaf checksums, leaf hashes, Merkle levels) for an image.
+    // Hashing and the Merkle build each report a `progress` stage.
+    static VersionHashes buildRecord(const cv::Mat& image, int minSize, Progress* progress = nullptr);
+
+    // Same record as buildRecord, but leaves whose raw bytes match the parent's reuse its
+    // perceptual hashes and only the dirty Merkle paths are recomputed. Falls back to a
+    // full build when the parent's layout differs. `rehashed` receives the dirty leaf count.
+    static VersionHashes buildRecordIncremental(const cv::Mat& image, int minSize,
+                                                const VersionHashes& parent, size_t* rehashed = nullptr,
+                                                Progress* progress = nullptr);
+
+    // Global perceptual hash plus a grid of cell hashes, for version similarity
+    static VersionSignature buildSignature(const cv::Mat& image);
+    // The signature's global hash alone, for query images
+    static uint64_t globalHash(const cv::Mat& image);
+
+private:
+    // Signatures are hashed from an INTER_AREA copy of at most this many pixels per side:
+    // 32 per grid cell, the resolution each perceptual hash is taken at anyway
+    static const int SIGNATURE_SIZE = VersionSignature::GRID * 32;
+
+    // The image itself if it already fits, otherwise the downscaled copy in `buffer`
+    static const cv::Mat& signatureImage(const cv::Mat& image, cv::Mat& buffer);
+};
+
+#endif // LEAFHASHER_H
@@ -1,37 +1,142 @@
 #include "MerkleTree.h"
+#include "Progress.h"
 #include <openssl/sha.h>
 #include <sstream>
 #include <iomanip>
+#include <stdexcept>
+#include <algorithm>
 
 // Constructor: Builds the Merkle Tree from data blocks
-MerkleTree::MerkleTree(const std::vector<std::string>& dataBlocks) {
-    tree = buildTree(dataBlocks);
+MerkleTree::MerkleTree(const std::vector<std::string>& dataBlocks, Progress* progress) {
+    buildTree(dataBlocks, progress);
+}
+
+// Constructor: Restores a Merkle Tree from stored levels
+MerkleTree::MerkleTree(const std::vector<std::vector<std::string>>& levels) : levels(levels) {
+    for (size_t l = 1; l < this->levels.size(); l++) {
+        if (this->levels[l].size() != (this->levels[l - 1].size() + 1) / 2) {
+            throw std::invalid_argument("Stored Merkle levels are inconsistent");
+        }
+    }
 }
 
 // Returns the root hash of the Merkle Tree
 std::string MerkleTree::getRootHash() const {
-    return tree.empty() ? "" : tree.back();
+    return (levels.empty() || levels.back().empty()) ? "" : levels.back().front();
 }
 
-// Builds the Merkle Tree and returns the tree structure
-std::vector<std::string> MerkleTree::buildTree(const std::vector<std::string>& dataBlocks) {
-    std::vector<std::string> currentLevel = dataBlocks;
+// Returns every level of the tree, leaves first
+const std::vector<std::vector<std::string>>& MerkleTree::getLevels() const {
+    return levels;
+}
+
+// Builds the Merkle Tree level by level
+void MerkleTree::buildTree(const std::vector<std::string>& dataBlocks, Progress* progress) {
+    levels.clear();
+    levels.push_back(dataBlocks);
+
+    if (progress) {
+        size_t innerNodes = 0;
+        for (size_t width = dataBlocks.size(); width > 1; width = (width + 1) / 2) {
+            innerNodes += (width + 1) / 2;
+        }
+        progress->begin("Building Merkle tree", innerNodes, "nodes");
+    }
 
-    while (currentLevel.size() > 1) {
+    while (levels.back().size() > 1) {
+        const std::vector<std::string>& currentLevel = levels.back();
         std::vector<std::string> nextLevel;
+        nextLevel.reserve((currentLevel.size() + 1) / 2);
 
         for (size_t i = 0; i < currentLevel.size(); i += 2) {
-            if (i + 1 < currentLevel.size()) {
-                nextLevel.push_back(hash(currentLevel[i] + currentLevel[i + 1]));
-            } else {
-                nextLevel.push_back(hash(currentLevel[i])); // Handle odd number of nodes
+            nextLevel.push_back(hashNode(currentLevel, i / 2));
+            if (progress) progress->step();
+        }
+
+        levels.push_back(std::move(nextLevel));
+    }
+    if (progress) progress->finish();
+}
+
+// Recomputes the dirty paths; the result is identical to rebuilding from scratch
+void MerkleTree::updateLeaves(const std::vector<size_t>& indices, const std::vector<std::string>& newBlocks) {
+    if (indices.size() != newBlocks.size()) {
+        throw std::invalid_argument("Leaf indices and blocks must have the same length");
+    }
+    if (levels.empty()) {
+        throw std::logic_error("Cannot update an empty Merkle Tree");
+    }
+
+    std::vector<size_t> dirty;
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (indices[i] >= levels[0].size()) {
+            throw std::out_of_range("Merkle leaf index out of range");
+        }
+        levels[0][indices[i]] = newBlocks[i];
+        dirty.push_back(indices[i]);
+    }
+
+    for (size_t l = 1; l < levels.size() && !dirty.empty(); l++) {
+        std::vector<size_t> parents;
+        for (size_t index : dirty) {
+            size_t parent = index / 2;
+            if (parents.empty() || parents.back() != parent) {
+                parents.push_back(parent);
             }
         }
+        // Indices arrive in any order; keep each parent once
+        std::sort(parents.begin(), parents.end());
+        parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+
+        for (size_t parent : parents) {
+            levels[l][parent] = hashNode(levels[l - 1], parent);
+        }
+        dirty.swap(parents);
+    }
+}
+
+// Top-down comparison; subtrees with equal digests are skipped entirely
+std::vector<size_t> MerkleTree::differingLeaves(const MerkleTree& other) const {
+    if (levels.size() != other.levels.size() || levels.empty() || levels[0].size() != other.levels[0].size()) {
+        throw std::invalid_argument("Merkle Trees have different shapes");
+    }
+
+    std::vector<size_t> leaves;
+    collectDiffering(other, levels.size() - 1, 0, leaves);
+    return leaves;
+}
+
+// Descends into the children that differ; when none do (the node's own digest is what
+// changed), every leaf below the node is reported
+void MerkleTree::collectDiffering(const MerkleTree& other, size_t level, size_t index,
+                                  std::vector<size_t>& leaves) const {
+    if (levels[level][index] == other.levels[level][index]) {
+        return;
+    }
+
+    size_t before = leaves.size();
+    if (level > 0) {
+        for (size_t child = index * 2; child <= index * 2 + 1 && child < levels[level - 1].size(); child++) {
+            collectDiffering(other, level - 1, child, leaves);
+        }
+    }
 
-        currentLevel = nextLevel;
+    if (leaves.size() == before) {
+        size_t first = index << level;
+        size_t last = std::min((index + 1) << level, levels[0].size());
+        for (size_t leaf = first; leaf < last; leaf++) {
+            leaves.push_back(leaf);
+        }
     }
+}
 
-    return currentLevel;
+// Digest of a parent node from its (one or two) children
+std::string MerkleTree::hashNode(const std::vector<std::string>& level, size_t parentIndex) const {
+    size_t i = parentIndex * 2;
+    if (i + 1 < level.size()) {
+        return hash(level[i] + level[i + 1]);
+    }
+    return hash(level[i]); // Handle odd number of nodes
 }
 
 // Hashes a string using SHA-256
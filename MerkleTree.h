@@ -4,16 +4,31 @@
 #include <string>
 #include <vector>
 
+class Progress;
+
 class MerkleTree {
 public:
-    MerkleTree(const std::vector<std::string>& dataBlocks);
+    // `progress`, when given, reports the build as a stage counted in nodes
+    MerkleTree(const std::vector<std::string>& dataBlocks, Progress* progress = nullptr);
+    // Restores a tree from previously stored levels (leaves first, root last)
+    MerkleTree(const std::vector<std::vector<std::string>>& levels);
     std::string getRootHash() const;
+    const std::vector<std::vector<std::string>>& getLevels() const;
+
+    // Replaces some leaves and recomputes only the digests on their paths to the root
+    void updateLeaves(const std::vector<size_t>& indices, const std::vector<std::string>& newBlocks);
+
+    // Leaves under the lowest nodes whose digests differ from `other`, found by descending from
+    // the root into differing children only. Both trees must have the same number of leaves.
+    std::vector<size_t> differingLeaves(const MerkleTree& other) const;
 
 private:
-    std::vector<std::string> buildTree(const std::vector<std::string>& dataBlocks);
+    void buildTree(const std::vector<std::string>& dataBlocks, Progress* progress);
+    std::string hashNode(const std::vector<std::string>& level, size_t parentIndex) const;
     std::string hash(const std::string& input) const;
+    void collectDiffering(const MerkleTree& other, size_t level, size_t index, std::vector<size_t>& leaves) const;
 
-    std::vector<std::string> tree;
+    std::vector<std::vector<std::string>> levels;
 };
 
-#endif // MERKLETREE_H
\ No newline at end of file
+#endif // MERKLETREE_H
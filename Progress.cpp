@@ -0,0 +1,84 @@
+#include "Progress.h"
+
+Progress::Progress(const CancellationToken* token, Callback callback)
+    : token(token), callback(std::move(callback)), start(std::chrono::steady_clock::now()) {}
+
+// Stages are begun and finished by the thread running the operation, with no workers active
+void Progress::begin(const std::string& stageName, size_t stageTotal, const std::string& stageUnit) {
+    throwIfCancelled();
+
+    std::lock_guard<std::mutex> lock(reportMutex);
+    stage = stageName;
+    unit = stageUnit;
+    total = stageTotal;
+    start = std::chrono::steady_clock::now();
+    done.store(0, std::memory_order_relaxed);
+    lastReport.store(0, std::memory_order_relaxed);
+    reported = false;
+}
+
+// The first thread past the interval reports; the others carry on without waiting
+bool Progress::advance(size_t count) {
+    done.fetch_add(count, std::memory_order_relaxed);
+
+    if (callback) {
+        const int64_t interval = static_cast<int64_t>(REPORT_INTERVAL_MS) * 1000000;
+        int64_t now = elapsedNanoseconds();
+        int64_t last = lastReport.load(std::memory_order_relaxed);
+        if (now - last >= interval && lastReport.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            std::unique_lock<std::mutex> lock(reportMutex, std::try_to_lock);
+            if (lock.owns_lock()) {
+                report(now, false);
+            }
+        }
+    }
+
+    return !isCancelled();
+}
+
+void Progress::step(size_t count) {
+    if (!advance(count)) {
+        throw OperationCancelled();
+    }
+}
+
+void Progress::finish() {
+    std::lock_guard<std::mutex> lock(reportMutex);
+    if (callback && reported) {
+        report(elapsedNanoseconds(), true);
+    }
+}
+
+bool Progress::isCancelled() const {
+    return token && token->isCancelled();
+}
+
+void Progress::throwIfCancelled() const {
+    if (token) token->throwIfCancelled();
+}
+
+int64_t Progress::elapsedNanoseconds() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Called with reportMutex held; the rate is the stage average, which is steadier than the
+// rate over the last interval
+void Progress::report(int64_t now, bool finished) {
+    ProgressStatus status;
+    status.stage = stage;
+    status.unit = unit;
+    status.done = done.load(std::memory_order_relaxed);
+    status.total = total;
+    status.finished = finished;
+
+    double seconds = now / 1e9;
+    if (seconds > 0) {
+        status.itemsPerSecond = status.done / seconds;
+    }
+    if (total > 0 && status.itemsPerSecond > 0 && status.done <= total) {
+        status.secondsLeft = (total - status.done) / status.itemsPerSecond;
+    }
+
+    reported = true;
+    callback(status);
+}
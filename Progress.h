@@ -0,0 +1,68 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "CancellationToken.h"
+
+// Snapshot of the current stage passed to the progress callback
+struct ProgressStatus {
+    std::string stage;
+    std::string unit;           // What is counted, e.g. "tiles"
+    size_t done = 0;
+    size_t total = 0;           // 0 when not known in advance
+    double itemsPerSecond = 0.0;
+    double secondsLeft = -1.0;  // Negative when it cannot be estimated
+    bool finished = false;      // Last report of the stage
+};
+
+// Progress of a long-running operation, made of stages run one after another. Work items
+// may be counted from any thread; the callback runs at most every REPORT_INTERVAL_MS and
+// never on two threads at once. Stages that finish within the first interval are not
+// reported at all. The same object carries the operation's cancellation token.
+class Progress {
+public:
+    using Callback = std::function<void(const ProgressStatus&)>;
+    static const int REPORT_INTERVAL_MS = 250;
+
+    explicit Progress(const CancellationToken* token = nullptr, Callback callback = Callback());
+
+    Progress(const Progress&) = delete;
+    Progress& operator=(const Progress&) = delete;
+
+    // Starts a stage; throws OperationCancelled if the operation was already cancelled
+    void begin(const std::string& stage, size_t total, const std::string& unit);
+    // Counts finished items; returns false once cancelled. Safe inside parallel loop bodies,
+    // which should stop early and leave the throw to the calling thread.
+    bool advance(size_t count = 1);
+    // advance() for serial loops: throws OperationCancelled once cancelled
+    void step(size_t count = 1);
+    // Reports the stage as finished, if it was reported at all
+    void finish();
+
+    bool isCancelled() const;
+    void throwIfCancelled() const;
+
+private:
+    int64_t elapsedNanoseconds() const;
+    void report(int64_t now, bool finished);
+
+    const CancellationToken* token;
+    Callback callback;
+
+    std::string stage;
+    std::string unit;
+    size_t total = 0;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<size_t> done{0};
+    std::atomic<int64_t> lastReport{0};
+    std::mutex reportMutex;
+    bool reported = false;
+};
+
+#endif // PROGRESS_H
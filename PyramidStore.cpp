@@ -0,0 +1,196 @@
+#include "PyramidStore.h"
+#include "Repository.h"
+#include "ImageProcessor.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// Each level is an INTER_AREA halving of the one above; the thumbnail is taken from the
+// smallest level that is still larger than it. Levels are 8-bit BGR previews whatever the
+// format of the snapshot.
+EncodedPyramid PyramidStore::build(const cv::Mat& image) {
+    if (image.empty()) {
+        throw std::runtime_error("Cannot build a pyramid for an empty image");
+    }
+
+    EncodedPyramid pyramid;
+    pyramid.fullSize = image.size();
+
+    const std::vector<int> params = {cv::IMWRITE_JPEG_QUALITY, 90};
+    cv::Mat previous = ImageProcessor::toDisplay(image);
+    cv::Mat thumbnailSource = previous;
+    for (int level = 1; level <= LEVELS; level++) {
+        cv::Mat scaled;
+        cv::resize(previous, scaled, cv::Size(std::max(1, previous.cols / 2), std::max(1, previous.rows / 2)),
+                   0, 0, cv::INTER_AREA);
+        if (std::max(scaled.cols, scaled.rows) >= THUMBNAIL_SIZE) {
+            thumbnailSource = scaled;
+        }
+
+        std::vector<uchar> encoded;
+        if (!cv::imencode(".jpg", scaled, encoded, params)) {
+            throw std::runtime_error("Could not encode preview level " + std::to_string(level) + ".");
+        }
+        pyramid.sizes.push_back(scaled.size());
+        pyramid.images.push_back(std::move(encoded));
+        previous = scaled;
+    }
+
+    double scale = std::min(1.0, static_cast<double>(THUMBNAIL_SIZE) / std::max(image.cols, image.rows));
+    cv::Size thumbnailSize(std::max(1, static_cast<int>(image.cols * scale)), std::max(1, static_cast<int>(image.rows * scale)));
+    cv::Mat thumbnail;
+    cv::resize(thumbnailSource, thumbnail, thumbnailSize, 0, 0, cv::INTER_AREA);
+
+    std::vector<uchar> encoded;
+    if (!cv::imencode(".jpg", thumbnail, encoded, params)) {
+        throw std::runtime_error("Could not encode the thumbnail.");
+    }
+    pyramid.sizes.push_back(thumbnail.size());
+    pyramid.images.push_back(std::move(encoded));
+
+    return pyramid;
+}
+
+// Writes the level images, then the manifest that makes them visible
+void PyramidStore::save(int version, const EncodedPyramid& pyramid) {
+    for (size_t i = 0; i < pyramid.images.size(); i++) {
+        Repository::writeFileAtomically(levelPath(version, static_cast<int>(i) + 1),
+                                        pyramid.images[i].data(), pyramid.images[i].size());
+    }
+
+    std::ostringstream manifest;
+    manifest << "versionary-pyramid 1\n";
+    manifest << "full " << pyramid.fullSize.width << " " << pyramid.fullSize.height << "\n";
+    for (size_t i = 0; i < pyramid.sizes.size(); i++) {
+        manifest << "level " << (i + 1) << " " << pyramid.sizes[i].width << " " << pyramid.sizes[i].height << "\n";
+    }
+    std::string contents = manifest.str();
+    Repository::writeFileAtomically(manifestPath(version), contents.data(), contents.size());
+}
+
+void PyramidStore::remove(int version) {
+    std::remove(manifestPath(version).c_str());
+    for (int level = 1; level <= THUMBNAIL; level++) {
+        std::remove(levelPath(version, level).c_str());
+    }
+}
+
+cv::Mat PyramidStore::load(Repository& repository, int version, const cv::Size& needed) {
+    cv::Size full;
+    std::vector<cv::Size> sizes;
+    if (!readManifest(version, full, sizes)) {
+        EncodedPyramid pyramid;
+        if (!backfill(repository, version, pyramid)) {
+            return cv::Mat();
+        }
+        full = pyramid.fullSize;
+        sizes = pyramid.sizes;
+    }
+
+    // Levels get smaller with the index, so search from the thumbnail up
+    for (int level = static_cast<int>(sizes.size()); level >= 1; level--) {
+        const cv::Size& size = sizes[level - 1];
+        if (size.width >= needed.width && size.height >= needed.height) {
+            cv::Mat image = cv::imread(levelPath(version, level));
+            if (!image.empty()) {
+                return image;
+            }
+        }
+    }
+    return cv::imread(Repository::snapshotPath(version));
+}
+
+cv::Mat PyramidStore::loadLevel(Repository& repository, int version, int level) {
+    if (level <= 0) {
+        return cv::imread(Repository::snapshotPath(version), cv::IMREAD_UNCHANGED);
+    }
+    cv::Size full;
+    std::vector<cv::Size> sizes;
+    if (!readManifest(version, full, sizes)) {
+        EncodedPyramid pyramid;
+        if (!backfill(repository, version, pyramid)) {
+            return cv::Mat();
+        }
+    }
+    return cv::imread(levelPath(version, std::min(level, static_cast<int>(THUMBNAIL))));
+}
+
+bool PyramidStore::fullSize(Repository& repository, int version, cv::Size& size) {
+    std::vector<cv::Size> sizes;
+    if (readManifest(version, size, sizes)) {
+        return true;
+    }
+    EncodedPyramid pyramid;
+    if (!backfill(repository, version, pyramid)) {
+        return false;
+    }
+    size = pyramid.fullSize;
+    return true;
+}
+
+std::string PyramidStore::levelPath(int version, int level) {
+    if (level == THUMBNAIL) {
+        return "version_" + std::to_string(version) + ".thumb.jpg";
+    }
+    return "version_" + std::to_string(version) + ".level" + std::to_string(level) + ".jpg";
+}
+
+std::string PyramidStore::manifestPath(int version) {
+    return "version_" + std::to_string(version) + ".pyramid";
+}
+
+bool PyramidStore::readManifest(int version, cv::Size& full, std::vector<cv::Size>& sizes) {
+    std::ifstream infile(manifestPath(version));
+    if (!infile.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    std::string magic;
+    int formatVersion = 0;
+    if (!std::getline(infile, line) || !(std::istringstream(line) >> magic >> formatVersion) ||
+        magic != "versionary-pyramid" || formatVersion != 1) {
+        return false;
+    }
+
+    sizes.clear();
+    bool haveFull = false;
+    while (std::getline(infile, line)) {
+        std::istringstream iss(line);
+        std::string keyword;
+        iss >> keyword;
+        if (keyword == "full") {
+            haveFull = static_cast<bool>(iss >> full.width >> full.height);
+        } else if (keyword == "level") {
+            int level;
+            cv::Size size;
+            if (!(iss >> level >> size.width >> size.height) || level != static_cast<int>(sizes.size()) + 1) {
+                return false;
+            }
+            sizes.push_back(size);
+        }
+    }
+    return haveFull && sizes.size() == static_cast<size_t>(THUMBNAIL);
+}
+
+// Versions added before pyramids existed: one full decode, after which it is never needed again.
+// The files are written under the repository lock, and only if the version was not removed
+// while it was being decoded.
+bool PyramidStore::backfill(Repository& repository, int version, EncodedPyramid& pyramid) {
+    cv::Mat image = cv::imread(Repository::snapshotPath(version), cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+        return false;
+    }
+    pyramid = build(image);
+
+    bool saved = false;
+    repository.locked([&](const Repository::VersionMap& current) {
+        if (current.count(version)) {
+            save(version, pyramid);
+            saved = true;
+        }
+    });
+    return saved;
+}
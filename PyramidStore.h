@@ -0,0 +1,47 @@
+#ifndef PYRAMIDSTORE_H
+#define PYRAMIDSTORE_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+class Repository;
+
+// Encoded pyramid of one version, ready to be written
+struct EncodedPyramid {
+    cv::Size fullSize;
+    std::vector<cv::Size> sizes;              // Level 1..LEVELS, then the thumbnail
+    std::vector<std::vector<uchar>> images;   // JPEG data, same order as sizes
+};
+
+// Downscaled copies of each version kept next to its snapshot: 1/2, 1/4 and 1/8 scale plus
+// a thumbnail. Their sizes are listed in version_<N>.pyramid, so the smallest level that is
+// large enough can be chosen without decoding any image.
+class PyramidStore {
+public:
+    static const int LEVELS = 3;            // 1/2, 1/4, 1/8
+    static const int THUMBNAIL = LEVELS + 1; // Level index of the thumbnail
+    static const int THUMBNAIL_SIZE = 128;  // Longest side of the thumbnail
+
+    static EncodedPyramid build(const cv::Mat& image);
+    static void save(int version, const EncodedPyramid& pyramid);
+    static void remove(int version);
+
+    // Smallest stored image at least `needed` in both dimensions; the full snapshot if no
+    // level is. Versions without a pyramid get one built on first use, saved under the
+    // repository lock.
+    static cv::Mat load(Repository& repository, int version, const cv::Size& needed);
+    // Level 0 is the full snapshot
+    static cv::Mat loadLevel(Repository& repository, int version, int level);
+    // Size of the full snapshot, from the manifest (built first if missing)
+    static bool fullSize(Repository& repository, int version, cv::Size& size);
+
+    static std::string levelPath(int version, int level);
+    static std::string manifestPath(int version);
+
+private:
+    static bool readManifest(int version, cv::Size& full, std::vector<cv::Size>& sizes);
+    static bool backfill(Repository& repository, int version, EncodedPyramid& pyramid);
+};
+
+#endif // PYRAMIDSTORE_H
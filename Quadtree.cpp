@@ -2,21 +2,25 @@
 #include <sstream>
 
 // Constructor for QuadtreeNode
-QuadtreeNode::QuadtreeNode(const cv::Rect& region, const cv::Mat& image)
-    : region(region), topLeft(nullptr), topRight(nullptr), bottomLeft(nullptr), bottomRight(nullptr) {
+QuadtreeNode::QuadtreeNode(const cv::Rect& region, const cv::Mat& image, const cv::Point& origin)
+    : topLeft(nullptr), topRight(nullptr), bottomLeft(nullptr), bottomRight(nullptr), region(region) {
+    // Region relative to the pixels we were handed
+    cv::Rect local(region.x - origin.x, region.y - origin.y, region.width, region.height);
+
     // Validate ROI dimensions with proper error message
-    if (region.x < 0 || region.y < 0 || region.width <= 0 || region.height <= 0 ||
-        region.x + region.width > image.cols || region.y + region.height > image.rows) {
+    if (local.x < 0 || local.y < 0 || local.width <= 0 || local.height <= 0 ||
+        local.x + local.width > image.cols || local.y + local.height > image.rows) {
         std::stringstream ss;
         ss << "Invalid ROI dimensions in QuadtreeNode. "
            << "ROI: [x=" << region.x << ", y=" << region.y 
            << ", width=" << region.width << ", height=" << region.height << "] "
-           << "Image: [width=" << image.cols << ", height=" << image.rows << "]";
+           << "Image: [x=" << origin.x << ", y=" << origin.y
+           << ", width=" << image.cols << ", height=" << image.rows << "]";
         throw std::invalid_argument(ss.str());
     }
 
-    // Extract the chunk (ROI) from the image
-    chunk = image(region).clone(); // Clone to ensure deep copy
+    // View of the chunk (ROI); the parent's buffer is reference counted, so no copy is needed
+    chunk = image(local);
 }
 
 // Checks if the node is a leaf (no children)
@@ -24,8 +28,8 @@ bool QuadtreeNode::isLeaf() const {
     return !topLeft && !topRight && !bottomLeft && !bottomRight;
 }
 
-// Subdivides the node into four children
-void QuadtreeNode::subdivide() {
+// Splits a region into four child regions
+void QuadtreeNode::splitRegion(const cv::Rect& region, cv::Rect children[4]) {
     // Calculate dimensions for child nodes
     int halfWidth = region.width / 2;
     int halfHeight = region.height / 2;
@@ -34,33 +38,40 @@ void QuadtreeNode::subdivide() {
     int rightHalfWidth = region.width - halfWidth;
     int bottomHalfHeight = region.height - halfHeight;
 
+    children[0] = cv::Rect(region.x, region.y, halfWidth, halfHeight);
+    children[1] = cv::Rect(region.x + halfWidth, region.y, rightHalfWidth, halfHeight);
+    children[2] = cv::Rect(region.x, region.y + halfHeight, halfWidth, bottomHalfHeight);
+    children[3] = cv::Rect(region.x + halfWidth, region.y + halfHeight, rightHalfWidth, bottomHalfHeight);
+}
+
+// Subdivides the node into four children
+void QuadtreeNode::subdivide() {
     // Create child regions
-    cv::Rect topLeftRegion(region.x, region.y, halfWidth, halfHeight);
-    cv::Rect topRightRegion(region.x + halfWidth, region.y, rightHalfWidth, halfHeight);
-    cv::Rect bottomLeftRegion(region.x, region.y + halfHeight, halfWidth, bottomHalfHeight);
-    cv::Rect bottomRightRegion(region.x + halfWidth, region.y + halfHeight, rightHalfWidth, bottomHalfHeight);
-
-    // Create child nodes if regions are valid
-    if (isValidRegion(topLeftRegion)) {
-        topLeft = std::make_shared<QuadtreeNode>(topLeftRegion, chunk);
+    cv::Rect children[4];
+    splitRegion(region, children);
+
+    // Create child nodes if regions are valid. Child regions are in image coordinates,
+    // so tell each child where our chunk starts.
+    if (isValidRegion(children[0])) {
+        topLeft = std::make_shared<QuadtreeNode>(children[0], chunk, region.tl());
     }
-    if (isValidRegion(topRightRegion)) {
-        topRight = std::make_shared<QuadtreeNode>(topRightRegion, chunk);
+    if (isValidRegion(children[1])) {
+        topRight = std::make_shared<QuadtreeNode>(children[1], chunk, region.tl());
     }
-    if (isValidRegion(bottomLeftRegion)) {
-        bottomLeft = std::make_shared<QuadtreeNode>(bottomLeftRegion, chunk);
+    if (isValidRegion(children[2])) {
+        bottomLeft = std::make_shared<QuadtreeNode>(children[2], chunk, region.tl());
     }
-    if (isValidRegion(bottomRightRegion)) {
-        bottomRight = std::make_shared<QuadtreeNode>(bottomRightRegion, chunk);
+    if (isValidRegion(children[3])) {
+        bottomRight = std::make_shared<QuadtreeNode>(children[3], chunk, region.tl());
     }
 }
 
-// Helper function to validate a region
-bool QuadtreeNode::isValidRegion(const cv::Rect& region) const {
-    return region.x >= 0 && region.y >= 0 &&
-           region.width > 0 && region.height > 0 &&
-           region.x + region.width <= chunk.cols &&
-           region.y + region.height <= chunk.rows;
+// Helper function to validate a child region against this node's region
+bool QuadtreeNode::isValidRegion(const cv::Rect& childRegion) const {
+    return childRegion.width > 0 && childRegion.height > 0 &&
+           childRegion.x >= region.x && childRegion.y >= region.y &&
+           childRegion.x + childRegion.width <= region.x + region.width &&
+           childRegion.y + childRegion.height <= region.y + region.height;
 }
 
 // Constructor for Quadtree
@@ -82,10 +93,14 @@ std::shared_ptr<QuadtreeNode> Quadtree::getRoot() const {
     return root;
 }
 
+// Stop subdivision once the region is no larger than the minimum size
+bool Quadtree::shouldSubdivide(const cv::Rect& region, int minSize) {
+    return region.width > minSize && region.height > minSize;
+}
+
 // Recursively builds the Quadtree
 void Quadtree::buildTree(std::shared_ptr<QuadtreeNode> node, int minSize) {
-    // Stop subdivision if the region is smaller than the minimum size
-    if (node->region.width <= minSize || node->region.height <= minSize) {
+    if (!shouldSubdivide(node->region, minSize)) {
         return;
     }
 
@@ -98,3 +113,76 @@ void Quadtree::buildTree(std::shared_ptr<QuadtreeNode> node, int minSize) {
     if (node->bottomLeft) buildTree(node->bottomLeft, minSize);
     if (node->bottomRight) buildTree(node->bottomRight, minSize);
 }
+
+// Computes the leaf layout of a Quadtree without building one
+std::vector<cv::Rect> Quadtree::leafRegions(const cv::Size& imageSize, int minSize) {
+    if (imageSize.width <= 0 || imageSize.height <= 0) {
+        throw std::invalid_argument("Invalid image dimensions for Quadtree construction");
+    }
+
+    std::vector<cv::Rect> regions;
+    collectLeafRegions(cv::Rect(0, 0, imageSize.width, imageSize.height), minSize, regions);
+    return regions;
+}
+
+// Mirrors buildTree: same stop rule, same child order, same skipping of empty children
+void Quadtree::collectLeafRegions(const cv::Rect& region, int minSize, std::vector<cv::Rect>& regions) {
+    if (!shouldSubdivide(region, minSize)) {
+        regions.push_back(region);
+        return;
+    }
+
+    cv::Rect children[4];
+    QuadtreeNode::splitRegion(region, children);
+
+    bool anyChild = false;
+    for (const auto& child : children) {
+        if (child.width > 0 && child.height > 0) {
+            collectLeafRegions(child, minSize, regions);
+            anyChild = true;
+        }
+    }
+
+    // A node whose children were all rejected stays a leaf
+    if (!anyChild) {
+        regions.push_back(region);
+    }
+}
+
+std::vector<cv::Rect> Quadtree::nodeRegions(const cv::Size& imageSize, int minSize, int depth,
+                                            std::vector<cv::Point>* cells) {
+    if (imageSize.width <= 0 || imageSize.height <= 0) {
+        throw std::invalid_argument("Invalid image dimensions for Quadtree construction");
+    }
+
+    std::vector<cv::Rect> regions;
+    if (cells) cells->clear();
+    collectNodeRegions(cv::Rect(0, 0, imageSize.width, imageSize.height), minSize, depth, cv::Point(0, 0),
+                       regions, cells);
+    return regions;
+}
+
+// collectLeafRegions, stopped `depth` levels down; `cell` is the node's grid position at its own level
+void Quadtree::collectNodeRegions(const cv::Rect& region, int minSize, int depth, const cv::Point& cell,
+                                  std::vector<cv::Rect>& regions, std::vector<cv::Point>* cells) {
+    if (depth > 0 && shouldSubdivide(region, minSize)) {
+        cv::Rect children[4];
+        QuadtreeNode::splitRegion(region, children);
+
+        bool anyChild = false;
+        for (int i = 0; i < 4; i++) {
+            if (children[i].width > 0 && children[i].height > 0) {
+                cv::Point childCell(cell.x * 2 + i % 2, cell.y * 2 + i / 2);
+                collectNodeRegions(children[i], minSize, depth - 1, childCell, regions, cells);
+                anyChild = true;
+            }
+        }
+        if (anyChild) return;
+    }
+
+    regions.push_back(region);
+    if (cells) {
+        // Scale the cell of a shallower leaf down to the requested depth
+        cells->push_back(cv::Point(cell.x << depth, cell.y << depth));
+    }
+}
@@ -3,13 +3,18 @@
 
 #include <opencv2/opencv.hpp>
 #include <memory>
+#include <vector>
 
 class QuadtreeNode {
 public:
-    QuadtreeNode(const cv::Rect& region, const cv::Mat& image);
+    // `image` holds the pixels of the area starting at `origin` (the parent's region)
+    QuadtreeNode(const cv::Rect& region, const cv::Mat& image, const cv::Point& origin = cv::Point(0, 0));
     bool isLeaf() const;
     void subdivide();
 
+    // Splits a region into its four child regions (odd dimensions go to the right/bottom half)
+    static void splitRegion(const cv::Rect& region, cv::Rect children[4]);
+
     std::shared_ptr<QuadtreeNode> topLeft;
     std::shared_ptr<QuadtreeNode> topRight;
     std::shared_ptr<QuadtreeNode> bottomLeft;
@@ -19,7 +24,7 @@ public:
     cv::Mat chunk;
 
 private:
-    bool isValidRegion(const cv::Rect& region) const;
+    bool isValidRegion(const cv::Rect& childRegion) const;
 };
 
 class Quadtree {
@@ -27,11 +32,23 @@ public:
     Quadtree(const cv::Mat& image, int minSize);
     std::shared_ptr<QuadtreeNode> getRoot() const;
 
+    // Leaf regions a Quadtree over an image of this size would have, in traversal order
+    // (top-left, top-right, bottom-left, bottom-right), without touching any pixels
+    static std::vector<cv::Rect> leafRegions(const cv::Size& imageSize, int minSize);
+    // Regions of the nodes at `depth` (or of shallower leaves), in traversal order. `cells`
+    // receives each region's top-left cell in the 2^depth x 2^depth grid of that depth.
+    static std::vector<cv::Rect> nodeRegions(const cv::Size& imageSize, int minSize, int depth,
+                                             std::vector<cv::Point>* cells = nullptr);
+
 private:
     void buildTree(std::shared_ptr<QuadtreeNode> node, int minSize);
+    static bool shouldSubdivide(const cv::Rect& region, int minSize);
+    static void collectLeafRegions(const cv::Rect& region, int minSize, std::vector<cv::Rect>& regions);
+    static void collectNodeRegions(const cv::Rect& region, int minSize, int depth, const cv::Point& cell,
+                                   std::vector<cv::Rect>& regions, std::vector<cv::Point>* cells);
 
     std::shared_ptr<QuadtreeNode> root;
     int minSize;
 };
 
-#endif // QUADTREE_H
\ No newline at end of file
+#endif // QUADTREE_H
@@ -0,0 +1,221 @@
+#include "Repository.h"
+#include "FileLock.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+Repository::Repository(const std::string& filename)
+    : filename(filename), lockFilename(filename + ".lock"),
+      versions(std::make_shared<VersionMap>()), latestVersion(0) {
+}
+
+// Loads the repository file; returns false if there is none yet
+bool Repository::load() {
+    std::lock_guard<std::mutex> guard(writeMutex);
+    FileLock lock(lockFilename, false);
+
+    VersionMap loaded;
+    if (!readFile(loaded)) {
+        std::cout << "No previous version repository found." << std::endl;
+        publishMap(VersionMap());
+        return false;
+    }
+
+    std::cout << "Loaded " << loaded.size() << " versions from repository" << std::endl;
+    publishMap(std::move(loaded));
+    return true;
+}
+
+// Current map; safe to iterate while other threads add or remove versions
+std::shared_ptr<const Repository::VersionMap> Repository::snapshot() const {
+    return std::atomic_load(&versions);
+}
+
+bool Repository::contains(int version) const {
+    auto current = snapshot();
+    return current->find(version) != current->end();
+}
+
+bool Repository::rootHash(int version, std::string& hash) const {
+    auto current = snapshot();
+    auto it = current->find(version);
+    if (it == current->end()) {
+        return false;
+    }
+    hash = it->second;
+    return true;
+}
+
+int Repository::currentVersion() const {
+    return latestVersion.load();
+}
+
+bool Repository::empty() const {
+    return snapshot()->empty();
+}
+
+size_t Repository::size() const {
+    return snapshot()->size();
+}
+
+// Adds a version under the lock, numbering it after everything on disk and in this process
+int Repository::addVersion(const std::string& rootHash, const std::function<void(int)>& publish) {
+    std::lock_guard<std::mutex> guard(writeMutex);
+    FileLock lock(lockFilename);
+
+    VersionMap updated;
+    readFile(updated);
+
+    int version = latestVersion.load();
+    if (!updated.empty() && updated.rbegin()->first > version) {
+        version = updated.rbegin()->first;
+    }
+    version++;
+
+    if (publish) {
+        publish(version);
+    }
+
+    updated[version] = rootHash;
+    writeFile(updated);
+    publishMap(std::move(updated));
+    return version;
+}
+
+// Removes a version under the lock, starting from the map on disk
+bool Repository::removeVersion(int version, const std::function<void(int)>& unpublish) {
+    std::lock_guard<std::mutex> guard(writeMutex);
+    FileLock lock(lockFilename);
+
+    VersionMap updated;
+    readFile(updated);
+
+    if (updated.erase(version) == 0) {
+        publishMap(std::move(updated));
+        return false;
+    }
+
+    if (unpublish) {
+        unpublish(version);
+    }
+
+    writeFile(updated);
+    publishMap(std::move(updated));
+    return true;
+}
+
+void Repository::locked(const std::function<void(const VersionMap&)>& operation) {
+    std::lock_guard<std::mutex> guard(writeMutex);
+    FileLock lock(lockFilename);
+
+    VersionMap current;
+    readFile(current);
+    operation(current);
+    publishMap(std::move(current));
+}
+
+bool Repository::readFile(VersionMap& versions) const {
+    return readVersions(filename, versions);
+}
+
+// Parses a repository file: one "<version> <root hash>" per line
+bool Repository::readVersions(const std::string& filename, VersionMap& versions) {
+    std::ifstream infile(filename);
+    if (!infile.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(infile, line)) {
+        std::istringstream iss(line);
+        int version;
+        std::string hash;
+
+        if (!(iss >> version >> hash)) {
+            std::cerr << "Error parsing line: " << line << std::endl;
+            continue;
+        }
+
+        versions[version] = hash;
+    }
+    return true;
+}
+
+void Repository::writeFile(const VersionMap& versions) const {
+    std::ostringstream out;
+    for (const auto& pair : versions) {
+        out << pair.first << " " << pair.second << "\n";
+    }
+    std::string contents = out.str();
+    writeFileAtomically(filename, contents.data(), contents.size());
+}
+
+// Publishes a new map for readers; the version counter never moves backwards
+void Repository::publishMap(VersionMap updated) {
+    int highest = updated.empty() ? 0 : updated.rbegin()->first;
+    int expected = latestVersion.load();
+    while (highest > expected && !latestVersion.compare_exchange_weak(expected, highest)) {
+    }
+
+    std::shared_ptr<const VersionMap> next = std::make_shared<VersionMap>(std::move(updated));
+    std::atomic_store(&versions, next);
+}
+
+std::string Repository::snapshotPath(int version, const std::string& directory) {
+    std::string prefix = directory.empty() ? "" : directory + "/";
+    std::string path = prefix + newSnapshotPath(version);
+    if (std::ifstream(path).good()) {
+        return path;
+    }
+    std::string legacyPath = prefix + "version_" + std::to_string(version) + ".jpg";
+    if (std::ifstream(legacyPath).good()) {
+        return legacyPath;
+    }
+    return path;
+}
+
+std::string Repository::newSnapshotPath(int version) {
+    return "version_" + std::to_string(version) + ".png";
+}
+
+bool Repository::isLegacySnapshot(const std::string& path) {
+    return path.size() > 4 && path.compare(path.size() - 4, 4, ".jpg") == 0;
+}
+
+void Repository::writeFileAtomically(const std::string& path, const void* data, size_t size) {
+    static std::atomic<unsigned> counter(0);
+    std::string tempPath = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(counter++);
+
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Could not open file for writing: " + tempPath);
+        }
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!out) {
+            out.close();
+            std::remove(tempPath.c_str());
+            throw std::runtime_error("Could not write file: " + tempPath);
+        }
+    }
+
+#ifdef _WIN32
+    bool renamed = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool renamed = std::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+    if (!renamed) {
+        std::remove(tempPath.c_str());
+        throw std::runtime_error("Could not replace file: " + path);
+    }
+}
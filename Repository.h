@@ -0,0 +1,70 @@
+#ifndef REPOSITORY_H
+#define REPOSITORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Version metadata (version number -> root hash) for every ingest and read path.
+// Reads work on an immutable snapshot of the map and never lock: writers copy the map,
+// change the copy and publish it atomically. Each change is made under a lock on the
+// repository file and starts from what is on disk, so several threads or processes
+// adding versions at once never reuse a number or lose each other's entries.
+class Repository {
+public:
+    typedef std::map<int, std::string> VersionMap;
+
+    explicit Repository(const std::string& filename = "version_repository.dat");
+
+    bool load();
+
+    std::shared_ptr<const VersionMap> snapshot() const;
+    bool contains(int version) const;
+    bool rootHash(int version, std::string& hash) const;
+    int currentVersion() const;
+    bool empty() const;
+    size_t size() const;
+
+    // Allocates the next version number and calls `publish` with it to write the version's
+    // files; the entry is recorded only if `publish` returns normally. Runs under the lock.
+    int addVersion(const std::string& rootHash, const std::function<void(int)>& publish = nullptr);
+
+    // Removes a version, calling `unpublish` under the same lock to delete its files.
+    // Returns false if the version does not exist.
+    bool removeVersion(int version, const std::function<void(int)>& unpublish = nullptr);
+
+    // Calls `operation` with the version list as it is on disk, under the same lock, for
+    // updating files that are kept in step with the list (such as the lookup indexes)
+    void locked(const std::function<void(const VersionMap&)>& operation);
+
+    // Snapshot image of a version. New snapshots are lossless PNG; versions added before that
+    // have JPEG snapshots, which are returned when no PNG exists. `directory` selects another
+    // repository directory than the working one.
+    static std::string snapshotPath(int version, const std::string& directory = "");
+    // Parses a repository file without taking its lock, for reading another repository
+    // directory. Returns false if the file does not exist.
+    static bool readVersions(const std::string& filename, VersionMap& versions);
+    static std::string newSnapshotPath(int version);
+    static bool isLegacySnapshot(const std::string& path);
+
+    // Writes the data to a temporary file beside `path` and renames it over `path`, so
+    // readers see either the old or the new contents
+    static void writeFileAtomically(const std::string& path, const void* data, size_t size);
+
+private:
+    bool readFile(VersionMap& versions) const;
+    void writeFile(const VersionMap& versions) const;
+    void publishMap(VersionMap versions);
+
+    std::string filename;
+    std::string lockFilename;
+    std::shared_ptr<const VersionMap> versions; // Only accessed through std::atomic_load/atomic_store
+    std::atomic<int> latestVersion;             // Highest version number handed out
+    std::mutex writeMutex;                      // Orders writers in this process; FileLock orders processes
+};
+
+#endif // REPOSITORY_H
@@ -0,0 +1,179 @@
+#include "SimilarityIndex.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// Loads the index; returns false if there is no index file yet
+bool SimilarityIndex::load(const std::string& filename) {
+    std::ifstream infile(filename);
+    if (!infile.is_open()) {
+        return false;
+    }
+
+    entries.clear();
+    byRoot.clear();
+    nodes.clear();
+
+    // Each line: version, root hash, packed global hash (hex)
+    std::string line;
+    while (std::getline(infile, line)) {
+        std::istringstream iss(line);
+        int version;
+        std::string rootHash;
+        uint64_t globalHash;
+
+        if (!(iss >> version >> rootHash >> std::hex >> globalHash)) {
+            std::cerr << "Error parsing index line: " << line << std::endl;
+            continue;
+        }
+        insert(version, rootHash, globalHash);
+    }
+    return true;
+}
+
+// Saves the live entries; the tree is rebuilt from them on load
+void SimilarityIndex::save(const std::string& filename) const {
+    std::ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+
+    for (const auto& pair : entries) {
+        outfile << std::dec << pair.first << " " << pair.second.rootHash << " "
+                << std::hex << pair.second.globalHash << "\n";
+    }
+}
+
+void SimilarityIndex::append(int version, const std::string& rootHash, uint64_t globalHash,
+                             const std::string& filename) {
+    std::ofstream outfile(filename, std::ios::app);
+    if (!outfile.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+    outfile << std::dec << version << " " << rootHash << " " << std::hex << globalHash << "\n";
+}
+
+// Adds (or replaces) a version
+void SimilarityIndex::insert(int version, const std::string& rootHash, uint64_t globalHash) {
+    if (contains(version)) {
+        remove(version);
+    }
+    entries[version] = Entry{rootHash, globalHash};
+    byRoot[rootHash].push_back(version);
+    insertIntoTree(version, globalHash);
+}
+
+// Removes a version from the exact map and from its tree node
+void SimilarityIndex::remove(int version) {
+    auto it = entries.find(version);
+    if (it == entries.end()) return;
+
+    auto rootIt = byRoot.find(it->second.rootHash);
+    if (rootIt != byRoot.end()) {
+        auto& versions = rootIt->second;
+        versions.erase(std::remove(versions.begin(), versions.end(), version), versions.end());
+        if (versions.empty()) byRoot.erase(rootIt);
+    }
+
+    // Walk the tree to the node holding this hash
+    const uint64_t hash = it->second.globalHash;
+    size_t current = 0;
+    while (!nodes.empty()) {
+        Node& node = nodes[current];
+        int distance = Utils::popcount64(node.hash ^ hash);
+        if (distance == 0) {
+            node.versions.erase(std::remove(node.versions.begin(), node.versions.end(), version), node.versions.end());
+            break;
+        }
+        auto child = std::find_if(node.children.begin(), node.children.end(),
+                                  [distance](const std::pair<int, size_t>& c) { return c.first == distance; });
+        if (child == node.children.end()) break;
+        current = child->second;
+    }
+
+    entries.erase(it);
+}
+
+bool SimilarityIndex::contains(int version) const {
+    return entries.find(version) != entries.end();
+}
+
+size_t SimilarityIndex::size() const {
+    return entries.size();
+}
+
+// Versions whose Merkle root equals the given one
+std::vector<int> SimilarityIndex::findExact(const std::string& rootHash) const {
+    auto it = byRoot.find(rootHash);
+    return it == byRoot.end() ? std::vector<int>() : it->second;
+}
+
+// The k versions with the closest global hashes, nearest first
+std::vector<SimilarityIndex::Match> SimilarityIndex::findNearest(uint64_t globalHash, size_t k) const {
+    std::vector<Match> best;
+    if (!nodes.empty() && k > 0) {
+        searchTree(0, globalHash, k, best);
+    }
+    std::sort(best.begin(), best.end(), [](const Match& a, const Match& b) {
+        return a.distance != b.distance ? a.distance < b.distance : a.version < b.version;
+    });
+    return best;
+}
+
+// Standard BK-tree insertion: follow the child at the same distance until a free slot
+void SimilarityIndex::insertIntoTree(int version, uint64_t hash) {
+    if (nodes.empty()) {
+        nodes.push_back(Node{hash, {version}, {}});
+        return;
+    }
+
+    size_t current = 0;
+    while (true) {
+        int distance = Utils::popcount64(nodes[current].hash ^ hash);
+        if (distance == 0) {
+            nodes[current].versions.push_back(version);
+            return;
+        }
+
+        auto& children = nodes[current].children;
+        auto child = std::find_if(children.begin(), children.end(),
+                                  [distance](const std::pair<int, size_t>& c) { return c.first == distance; });
+        if (child == children.end()) {
+            children.push_back({distance, nodes.size()});
+            nodes.push_back(Node{hash, {version}, {}});
+            return;
+        }
+        current = child->second;
+    }
+}
+
+// k-nearest search; subtrees outside the current k-th best radius are pruned
+// by the triangle inequality
+void SimilarityIndex::searchTree(size_t nodeIndex, uint64_t hash, size_t k, std::vector<Match>& best) const {
+    auto worse = [](const Match& a, const Match& b) { return a.distance < b.distance; };
+
+    const Node& node = nodes[nodeIndex];
+    int distance = Utils::popcount64(node.hash ^ hash);
+
+    for (int version : node.versions) {
+        if (best.size() < k) {
+            best.push_back(Match{version, distance});
+            std::push_heap(best.begin(), best.end(), worse);
+        } else if (distance < best.front().distance) {
+            std::pop_heap(best.begin(), best.end(), worse);
+            best.back() = Match{version, distance};
+            std::push_heap(best.begin(), best.end(), worse);
+        }
+    }
+
+    for (const auto& child : node.children) {
+        int radius = best.size() < k ? 64 : best.front().distance;
+        if (std::abs(child.first - distance) <= radius) {
+            searchTree(child.second, hash, k, best);
+        }
+    }
+}
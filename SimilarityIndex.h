@@ -0,0 +1,57 @@
+#ifndef SIMILARITYINDEX_H
+#define SIMILARITYINDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Persistent lookup index over stored versions: an exact root-hash map plus a BK-tree
+// keyed by the packed global perceptual hash (Hamming distance), so the nearest
+// versions to a query image are found without scanning every version.
+class SimilarityIndex {
+public:
+    struct Match {
+        int version;
+        int distance; // Differing bits between global perceptual hashes (0-64)
+    };
+
+    bool load(const std::string& filename = "similarity_index.dat");
+    void save(const std::string& filename = "similarity_index.dat") const;
+    // Adds one entry to the index file without loading it; a later entry for the same
+    // version replaces an earlier one on load
+    static void append(int version, const std::string& rootHash, uint64_t globalHash,
+                       const std::string& filename = "similarity_index.dat");
+
+    void insert(int version, const std::string& rootHash, uint64_t globalHash);
+    void remove(int version);
+    bool contains(int version) const;
+    size_t size() const;
+
+    std::vector<int> findExact(const std::string& rootHash) const;
+    std::vector<Match> findNearest(uint64_t globalHash, size_t k) const;
+
+private:
+    struct Entry {
+        std::string rootHash;
+        uint64_t globalHash;
+    };
+
+    // Versions with identical global hashes share a node; removed versions leave the
+    // node in place as a routing point
+    struct Node {
+        uint64_t hash;
+        std::vector<int> versions;
+        std::vector<std::pair<int, size_t>> children; // (distance to child, child index)
+    };
+
+    void insertIntoTree(int version, uint64_t hash);
+    void searchTree(size_t nodeIndex, uint64_t hash, size_t k, std::vector<Match>& best) const;
+
+    std::map<int, Entry> entries;
+    std::unordered_map<std::string, std::vector<int>> byRoot;
+    std::vector<Node> nodes;
+};
+
+#endif // SIMILARITYINDEX_H
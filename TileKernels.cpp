@@ -0,0 +1,137 @@
+#include "TileKernels.h"
+#include "ImageProcessor.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace {
+
+// Deterministic pseudo-random test tile; noise over the full range of the depth hits every
+// rounding case of blur and resize
+template <typename T>
+cv::Mat makeTestTile(int width, int height, uint32_t seed) {
+    cv::Mat tile(height, width, sizeof(T) == 2 ? CV_16UC1 : CV_8UC1);
+    uint32_t state = seed;
+    for (int y = 0; y < height; y++) {
+        T* row = tile.ptr<T>(y);
+        for (int x = 0; x < width; x++) {
+            state = state * 1664525u + 1013904223u;
+            row[x] = static_cast<T>(state >> (32 - 8 * sizeof(T)));
+        }
+    }
+    return tile;
+}
+
+// Runs the kernel against the generic path on a few tiles of one shape
+template <int N, typename T>
+bool matchesGenericPath(int width, int height) {
+    try {
+        cv::Mat dctBuffer;
+        for (uint32_t seed = 1; seed <= 4; seed++) {
+            cv::Mat tile = makeTestTile<T>(width, height, seed);
+            if (BoundedTileKernel<N, T>::perceptualHash(tile, dctBuffer) != Utils::computePerceptualHash(tile) ||
+                BoundedTileKernel<N, T>::fastHash(tile) != Utils::computeFastHash(tile)) {
+                return false;
+            }
+        }
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// Checked once per process, depth and tile shape, on first use. A layout has only a few
+// distinct leaf shapes, and each thread remembers the last one it looked up.
+template <int N, typename T>
+bool verified(int width, int height) {
+    const uint32_t key = (static_cast<uint32_t>(width) << 16) | static_cast<uint32_t>(height);
+    thread_local uint32_t lastKey = 0;
+    thread_local bool lastResult = false;
+    if (key == lastKey) return lastResult;
+
+    static std::mutex mutex;
+    static std::map<uint32_t, bool> results;
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = results.find(key);
+        if (it == results.end()) {
+            it = results.emplace(key, matchesGenericPath<N, T>(width, height)).first;
+        }
+        ok = it->second;
+    }
+    lastKey = key;
+    lastResult = ok;
+    return ok;
+}
+
+// Only plain 8- or 16-bit tiles within the largest bound are eligible
+bool eligible(const cv::Mat& tile) {
+    return (tile.depth() == CV_8U || tile.depth() == CV_16U) &&
+           BoundedTileKernel<TileKernels::MAX_TILE>::fits(tile.cols, tile.rows);
+}
+
+// Smallest bound that holds the tile
+int boundFor(const cv::Mat& tile) {
+    const int side = std::max(tile.cols, tile.rows);
+    return side <= 8 ? 8 : side <= 16 ? 16 : side <= 32 ? 32 : 64;
+}
+
+template <int N, typename T>
+bool perceptualHashWith(const cv::Mat& gray, cv::Mat& dctBuffer, std::string& hash) {
+    if (!verified<N, T>(gray.cols, gray.rows)) return false;
+    hash = BoundedTileKernel<N, T>::perceptualHash(gray, dctBuffer);
+    return true;
+}
+
+template <int N, typename T>
+bool fastHashWith(const cv::Mat& gray, std::string& hash) {
+    if (!verified<N, T>(gray.cols, gray.rows)) return false;
+    hash = BoundedTileKernel<N, T>::fastHash(gray);
+    return true;
+}
+
+template <typename T>
+bool perceptualHashAt(const cv::Mat& gray, cv::Mat& dctBuffer, std::string& hash) {
+    switch (boundFor(gray)) {
+        case 8:  return perceptualHashWith<8, T>(gray, dctBuffer, hash);
+        case 16: return perceptualHashWith<16, T>(gray, dctBuffer, hash);
+        case 32: return perceptualHashWith<32, T>(gray, dctBuffer, hash);
+        default: return perceptualHashWith<64, T>(gray, dctBuffer, hash);
+    }
+}
+
+template <typename T>
+bool fastHashAt(const cv::Mat& gray, std::string& hash) {
+    switch (boundFor(gray)) {
+        case 8:  return fastHashWith<8, T>(gray, hash);
+        case 16: return fastHashWith<16, T>(gray, hash);
+        case 32: return fastHashWith<32, T>(gray, hash);
+        default: return fastHashWith<64, T>(gray, hash);
+    }
+}
+
+} // namespace
+
+// Specialised perceptual hash; luma for colour tiles still comes from OpenCV's cvtColor
+bool TileKernels::perceptualHash(const cv::Mat& tile, PerceptualHashScratch& scratch, std::string& hash) {
+    if (!eligible(tile)) return false;
+
+    const cv::Mat* gray = &tile;
+    if (tile.channels() == 3 || tile.channels() == 4) {
+        ImageProcessor::convertToGrayscale(tile, scratch.grayscale);
+        gray = &scratch.grayscale;
+    } else if (tile.channels() != 1) {
+        return false;
+    }
+
+    return tile.depth() == CV_16U ? perceptualHashAt<uint16_t>(*gray, scratch.dctImage, hash)
+                                  : perceptualHashAt<uint8_t>(*gray, scratch.dctImage, hash);
+}
+
+// Specialised fast hash; single-channel tiles only (the advanced comparison works on grayscale)
+bool TileKernels::fastHash(const cv::Mat& tile, std::string& hash) {
+    if (!eligible(tile) || tile.channels() != 1) return false;
+
+    return tile.depth() == CV_16U ? fastHashAt<uint16_t>(tile, hash) : fastHashAt<uint8_t>(tile, hash);
+}
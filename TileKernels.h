@@ -0,0 +1,183 @@
+#ifndef TILEKERNELS_H
+#define TILEKERNELS_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <opencv2/opencv.hpp>
+#include "Utils.h"
+
+// Accumulator wide enough for the blur and block sums of one pixel type
+template <typename T> struct TileAccumulator;
+template <> struct TileAccumulator<uint8_t> { using type = uint16_t; };
+template <> struct TileAccumulator<uint16_t> { using type = uint32_t; };
+
+// Leaf pipeline for tiles of at most N x N pixels, for 8-bit (T = uint8_t) or 16-bit
+// (T = uint16_t) luma. The bound is a template constant, so every intermediate lives in a
+// fixed-size stack array; the tile's own width and height are runtime values, which covers
+// the non-square leaves Quadtree layouts produce on most image sizes. The 1-2-1 blur runs
+// in place; the INTER_AREA resize averages or replicates pixels directly when both axes
+// scale by a power of two and otherwise calls cv::resize on the stack buffers. Results match
+// the generic OpenCV path (GaussianBlur 3x3 with BORDER_REFLECT_101, INTER_AREA resize) bit
+// for bit. Both depths run the same loops, with 16-bit pixels in wider accumulators.
+template <int N, typename T = uint8_t>
+class BoundedTileKernel {
+public:
+    static_assert(N >= 8 && (N & (N - 1)) == 0, "Tile bound must be a power of two >= 8");
+    static_assert(std::is_same<T, uint8_t>::value || std::is_same<T, uint16_t>::value,
+                  "Tiles are 8- or 16-bit");
+    using Sum = typename TileAccumulator<T>::type;
+
+    // Tiles of 2..N pixels along each side
+    static bool fits(int width, int height) {
+        return width >= 2 && height >= 2 && width <= N && height <= N;
+    }
+
+    // Perceptual hash of a single-channel tile (same bits as Utils::computePerceptualHash)
+    static std::string perceptualHash(const cv::Mat& gray, cv::Mat& dctBuffer) {
+        std::array<T, N * N> blurred;
+        blur3x3(gray, blurred.data());
+
+        std::array<T, 32 * 32> resized;
+        resizeArea<32>(blurred.data(), gray.cols, gray.rows, resized.data());
+
+        std::array<float, 32 * 32> resizedFloat;
+        for (int i = 0; i < 32 * 32; i++) {
+            resizedFloat[i] = resized[i];
+        }
+
+        // The DCT itself stays with OpenCV so coefficient rounding, and hence every hash bit,
+        // is identical to the generic path
+        cv::Mat dctInput(32, 32, CV_32F, resizedFloat.data());
+        cv::dct(dctInput, dctBuffer);
+        return Utils::perceptualHashFromDct(dctBuffer);
+    }
+
+    // Fast hash of a single-channel tile (same bits as Utils::computeFastHash)
+    static std::string fastHash(const cv::Mat& gray) {
+        const int width = gray.cols;
+        const int height = gray.rows;
+        std::array<T, N * N> tile;
+        for (int y = 0; y < height; y++) {
+            std::memcpy(&tile[y * width], gray.ptr<T>(y), width * sizeof(T));
+        }
+
+        std::array<T, 16 * 16> resized;
+        resizeArea<16>(tile.data(), width, height, resized.data());
+
+        uint64_t sum = 0;
+        for (int i = 0; i < 16 * 16; i++) {
+            sum += resized[i];
+        }
+        double mean = sum / 256.0;
+
+        std::string hash(16 * 16, '0');
+        for (int i = 0; i < 16 * 16; i++) {
+            if (resized[i] > mean) hash[i] = '1';
+        }
+        return hash;
+    }
+
+private:
+    // 3x3 Gaussian (sigma from ksize = 1-2-1 in both directions), reflect-101 borders,
+    // rounded the way OpenCV's fixed-point 8- and 16-bit paths round: (sum + 8) >> 4.
+    // The result is packed with a row stride of the tile width.
+    static void blur3x3(const cv::Mat& src, T* dst) {
+        const int width = src.cols;
+        const int height = src.rows;
+        std::array<Sum, N * N> rows;
+        for (int y = 0; y < height; y++) {
+            const T* s = src.ptr<T>(y);
+            Sum* r = &rows[y * width];
+            r[0] = static_cast<Sum>(2 * s[1] + 2 * s[0]);
+            for (int x = 1; x < width - 1; x++) {
+                r[x] = static_cast<Sum>(s[x - 1] + 2 * s[x] + s[x + 1]);
+            }
+            r[width - 1] = static_cast<Sum>(2 * s[width - 2] + 2 * s[width - 1]);
+        }
+
+        for (int y = 0; y < height; y++) {
+            const Sum* up = &rows[(y == 0 ? 1 : y - 1) * width];
+            const Sum* mid = &rows[y * width];
+            const Sum* down = &rows[(y == height - 1 ? height - 2 : y + 1) * width];
+            T* d = dst + y * width;
+            for (int x = 0; x < width; x++) {
+                d[x] = static_cast<T>((up[x] + 2 * mid[x] + down[x] + 8) >> 4);
+            }
+        }
+    }
+
+    static bool isPowerOfTwo(int value) {
+        return value > 0 && (value & (value - 1)) == 0;
+    }
+
+    // INTER_AREA resize of a packed width x height tile to M x M. Power-of-two downscaling
+    // averages Fx x Fy blocks (OpenCV's fast area path), power-of-two upscaling replicates
+    // pixels; any other ratio, including one axis up and the other down, goes to cv::resize.
+    template <int M>
+    static void resizeArea(const T* src, int width, int height, T* dst) {
+        if (width == M && height == M) {
+            std::memcpy(dst, src, M * M * sizeof(T));
+        } else if (width >= M && height >= M && width % M == 0 && height % M == 0 &&
+                   isPowerOfTwo(width / M) && isPowerOfTwo(height / M)) {
+            const int fx = width / M;
+            const int fy = height / M;
+            for (int y = 0; y < M; y++) {
+                for (int x = 0; x < M; x++) {
+                    Sum sum = 0;
+                    for (int dy = 0; dy < fy; dy++) {
+                        const T* s = src + (y * fy + dy) * width + x * fx;
+                        for (int dx = 0; dx < fx; dx++) {
+                            sum += s[dx];
+                        }
+                    }
+                    dst[y * M + x] = averageBlock(sum, fx, fy);
+                }
+            }
+        } else if (width <= M && height <= M && M % width == 0 && M % height == 0) {
+            const int rx = M / width;
+            const int ry = M / height;
+            for (int y = 0; y < M; y++) {
+                const T* s = src + (y / ry) * width;
+                T* d = dst + y * M;
+                for (int x = 0; x < M; x++) {
+                    d[x] = s[x / rx];
+                }
+            }
+        } else {
+            const int type = sizeof(T) == 2 ? CV_16UC1 : CV_8UC1;
+            cv::Mat source(height, width, type, const_cast<T*>(src));
+            cv::Mat destination(M, M, type, dst);
+            cv::resize(source, destination, destination.size(), 0, 0, cv::INTER_AREA);
+        }
+    }
+
+    // OpenCV rounds 2x2 blocks half up, other blocks to nearest even
+    static T averageBlock(Sum sum, int fx, int fy) {
+        const Sum area = static_cast<Sum>(fx * fy);
+        if (fx == 2 && fy == 2) {
+            return static_cast<T>((sum + 2) >> 2);
+        }
+        Sum q = sum / area;
+        Sum r = sum - q * area;
+        if (2 * r > area || (2 * r == area && (q & 1))) q++;
+        return static_cast<T>(q);
+    }
+};
+
+// Dispatches 8- and 16-bit leaves to the BoundedTileKernel instance with the smallest bound
+// of 8, 16, 32 or 64 pixels that holds them. Each tile shape is checked once against the
+// generic path on this OpenCV build and only uses the kernel if it matches; otherwise (and
+// for tiles larger than 64 pixels or of another depth) callers use the generic path.
+class TileKernels {
+public:
+    static const int MAX_TILE = 64;
+
+    // Return false when no verified kernel applies to this tile
+    static bool perceptualHash(const cv::Mat& tile, PerceptualHashScratch& scratch, std::string& hash);
+    static bool fastHash(const cv::Mat& tile, std::string& hash);
+};
+
+#endif // TILEKERNELS_H
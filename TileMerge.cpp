@@ -0,0 +1,98 @@
+#include "TileMerge.h"
+#include "ImageComparer.h"
+#include "MerkleTree.h"
+#include <stdexcept>
+
+// Classifies every leaf by comparing its checksum on the three sides
+MergePlan TileMerge::plan(const VersionHashes& base, const VersionHashes& ours, const VersionHashes& theirs) {
+    if (base.imageSize != ours.imageSize || base.imageSize != theirs.imageSize ||
+        base.minSize != ours.minSize || base.minSize != theirs.minSize ||
+        base.checksums.size() != ours.checksums.size() || base.checksums.size() != theirs.checksums.size()) {
+        throw std::runtime_error("Only versions with the same image size and tile size can be merged.");
+    }
+
+    MergePlan result;
+    result.sources.resize(base.checksums.size());
+    for (size_t i = 0; i < base.checksums.size(); i++) {
+        uint64_t b = base.checksums[i];
+        uint64_t o = ours.checksums[i];
+        uint64_t t = theirs.checksums[i];
+
+        TileSource source;
+        if (o == t) {
+            source = (o == b) ? TileSource::Unchanged : TileSource::Both;
+        } else if (o == b) {
+            source = TileSource::Theirs;
+        } else if (t == b) {
+            source = TileSource::Ours;
+        } else {
+            source = TileSource::Conflict;
+        }
+        result.sources[i] = source;
+
+        switch (source) {
+            case TileSource::Unchanged: result.unchanged++; break;
+            case TileSource::Ours:      result.ours++; break;
+            case TileSource::Theirs:    result.theirs++; break;
+            case TileSource::Both:      result.both++; break;
+            case TileSource::Conflict:  result.conflicts++; break;
+        }
+    }
+    return result;
+}
+
+bool TileMerge::fromTheirs(TileSource source, bool takeTheirs) {
+    return source == TileSource::Theirs || (source == TileSource::Conflict && takeTheirs);
+}
+
+void TileMerge::assemble(const MergePlan& plan, const VersionHashes& layout, const cv::Mat& theirsImage,
+                         bool takeTheirs, cv::Mat& merged) {
+    if (merged.size() != layout.imageSize || theirsImage.size() != layout.imageSize ||
+        merged.type() != theirsImage.type()) {
+        throw std::runtime_error("The images do not match the merge layout.");
+    }
+
+    for (size_t i = 0; i < plan.sources.size(); i++) {
+        if (fromTheirs(plan.sources[i], takeTheirs)) {
+            theirsImage(layout.regions[i]).copyTo(merged(layout.regions[i]));
+        }
+    }
+}
+
+// Starts from our record and swaps in their checksum and leaf hash wherever their tile was
+// taken; only the Merkle paths above those leaves are recomputed
+VersionHashes TileMerge::mergedRecord(const MergePlan& plan, const VersionHashes& ours, const VersionHashes& theirs,
+                                      bool takeTheirs) {
+    VersionHashes record = ours;
+
+    std::vector<size_t> dirtyIndices;
+    std::vector<std::string> dirtyHashes;
+    for (size_t i = 0; i < plan.sources.size(); i++) {
+        if (!fromTheirs(plan.sources[i], takeTheirs)) continue;
+        record.checksums[i] = theirs.checksums[i];
+        if (record.leafHashes[i] != theirs.leafHashes[i]) {
+            record.leafHashes[i] = theirs.leafHashes[i];
+            dirtyIndices.push_back(i);
+            dirtyHashes.push_back(theirs.leafHashes[i]);
+        }
+    }
+
+    if (ours.merkleLevels.empty()) {
+        record.merkleLevels = MerkleTree(record.leafHashes).getLevels();
+    } else if (!dirtyIndices.empty()) {
+        MerkleTree tree(ours.merkleLevels);
+        tree.updateLeaves(dirtyIndices, dirtyHashes);
+        record.merkleLevels = tree.getLevels();
+    }
+    return record;
+}
+
+std::vector<cv::Rect> TileMerge::conflictRegions(const MergePlan& plan, const VersionHashes& layout) {
+    std::vector<cv::Rect> tiles;
+    for (size_t i = 0; i < plan.sources.size(); i++) {
+        if (plan.sources[i] == TileSource::Conflict) {
+            tiles.push_back(layout.regions[i]);
+        }
+    }
+    return ImageComparer::mergeRegions(tiles, 1);
+}
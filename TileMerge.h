@@ -0,0 +1,50 @@
+#ifndef TILEMERGE_H
+#define TILEMERGE_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "HashStore.h"
+
+// Where a merged tile comes from
+enum class TileSource {
+    Unchanged,  // Same on all three sides
+    Ours,       // Changed on our side only
+    Theirs,     // Changed on their side only
+    Both,       // Changed identically on both sides
+    Conflict    // Changed differently on both sides
+};
+
+// Per-leaf classification of a three-way merge
+struct MergePlan {
+    std::vector<TileSource> sources;  // One per leaf, in the records' leaf order
+    size_t unchanged = 0;
+    size_t ours = 0;
+    size_t theirs = 0;
+    size_t both = 0;
+    size_t conflicts = 0;
+};
+
+// Three-way merge of versions at Quadtree leaf granularity. Leaves are classified from
+// the stored leaf checksums alone; pixels are only copied for tiles taken from their side.
+class TileMerge {
+public:
+    // The three records must share a layout (image size and leaf size)
+    static MergePlan plan(const VersionHashes& base, const VersionHashes& ours, const VersionHashes& theirs);
+
+    // Copies the tiles taken from their side into `merged`, which starts as our image.
+    // Conflicting tiles keep our pixels unless `takeTheirs` is set.
+    static void assemble(const MergePlan& plan, const VersionHashes& layout, const cv::Mat& theirsImage,
+                         bool takeTheirs, cv::Mat& merged);
+
+    // Hash record of the assembled image, built from the two records without hashing pixels
+    static VersionHashes mergedRecord(const MergePlan& plan, const VersionHashes& ours, const VersionHashes& theirs,
+                                      bool takeTheirs);
+
+    // Leaf regions of the conflicting tiles, touching tiles merged into one region
+    static std::vector<cv::Rect> conflictRegions(const MergePlan& plan, const VersionHashes& layout);
+
+private:
+    static bool fromTheirs(TileSource source, bool takeTheirs);
+};
+
+#endif // TILEMERGE_H
@@ -1,11 +1,15 @@
 #include "Utils.h"
+#include "ImageProcessor.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <bitset>
 #include <opencv2/imgproc.hpp>
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstring>
+#include <sys/stat.h>
 
 // Checks if a file exists
 bool Utils::fileExists(const std::string& filePath) {
@@ -13,6 +17,12 @@ bool Utils::fileExists(const std::string& filePath) {
     return file.good();
 }
 
+// Checks if a path names an existing directory
+bool Utils::directoryExists(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
 // Reads the content of a file
 std::string Utils::readFile(const std::string& filePath) {
     std::ifstream file(filePath);
@@ -50,6 +60,12 @@ std::vector<std::string> Utils::splitString(const std::string& input, char delim
 
 // Improved perceptual hash function with better error handling
 std::string Utils::computePerceptualHash(const cv::Mat& image) {
+    PerceptualHashScratch scratch;
+    return computePerceptualHash(image, scratch);
+}
+
+// Perceptual hash that works in caller-provided buffers (used by the per-leaf hashing loops)
+std::string Utils::computePerceptualHash(const cv::Mat& image, PerceptualHashScratch& scratch) {
     try {
         // Ensure we have a valid image
         if (image.empty()) {
@@ -57,43 +73,13 @@ std::string Utils::computePerceptualHash(const cv::Mat& image) {
         }
 
         // 1. Convert to grayscale and resize to 32x32
-        cv::Mat resized = preprocessForHash(image);
+        preprocessForHash(image, scratch);
         
         // 2. Apply DCT (Discrete Cosine Transform)
-        cv::Mat dctImage;
-        cv::dct(resized, dctImage);
-        
-        // 3. Extract the top-left 8x8 corner (low frequencies)
-        cv::Mat dctLowFreq = dctImage(cv::Rect(0, 0, 8, 8));
-        
-        // 4. Calculate the median of the 8x8 low frequencies (excluding DC component)
-        // (using median instead of mean provides better resistance to outliers)
-        std::vector<float> coefficients;
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (!(i == 0 && j == 0)) { // Skip the DC component (0,0)
-                    coefficients.push_back(dctLowFreq.at<float>(i, j));
-                }
-            }
-        }
-        
-        // Sort to find median
-        std::sort(coefficients.begin(), coefficients.end());
-        double median = coefficients.size() % 2 == 0 
-            ? (coefficients[coefficients.size()/2 - 1] + coefficients[coefficients.size()/2]) / 2
-            : coefficients[coefficients.size()/2];
+        cv::dct(scratch.resizedFloat, scratch.dctImage);
         
-        // 5. Generate a 64-bit hash based on whether each value is above the median
-        std::string hash;
-        hash.reserve(64); // Pre-allocate for efficiency
-        
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                hash += (dctLowFreq.at<float>(i, j) > median) ? "1" : "0";
-            }
-        }
-        
-        return hash;
+        // 3-5. Median-threshold the low frequencies
+        return perceptualHashFromDct(scratch.dctImage);
     }
     catch (const cv::Exception& e) {
         throw std::runtime_error("OpenCV error during perceptual hashing: " + std::string(e.what()));
@@ -103,29 +89,55 @@ std::string Utils::computePerceptualHash(const cv::Mat& image) {
     }
 }
 
+// Turns a 32x32 DCT into the 64-bit perceptual hash string
+std::string Utils::perceptualHashFromDct(const cv::Mat& dctImage) {
+    // 3. Extract the top-left 8x8 corner (low frequencies)
+    cv::Mat dctLowFreq = dctImage(cv::Rect(0, 0, 8, 8));
+    
+    // 4. Calculate the median of the 8x8 low frequencies (excluding DC component)
+    // (using median instead of mean provides better resistance to outliers)
+    std::array<float, 63> coefficients;
+    size_t count = 0;
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            if (!(i == 0 && j == 0)) { // Skip the DC component (0,0)
+                coefficients[count++] = dctLowFreq.at<float>(i, j);
+            }
+        }
+    }
+    
+    // 63 coefficients, so the median is the middle element
+    std::nth_element(coefficients.begin(), coefficients.begin() + count / 2, coefficients.end());
+    double median = coefficients[count / 2];
+    
+    // 5. Generate a 64-bit hash based on whether each value is above the median
+    std::string hash;
+    hash.reserve(64); // Pre-allocate for efficiency
+    
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            hash += (dctLowFreq.at<float>(i, j) > median) ? '1' : '0';
+        }
+    }
+    
+    return hash;
+}
+
 // Improved preprocessForHash function with more robust handling
-cv::Mat Utils::preprocessForHash(const cv::Mat& image) {
+// Leaves the blurred 32x32 float image in scratch.resizedFloat
+void Utils::preprocessForHash(const cv::Mat& image, PerceptualHashScratch& scratch) {
     try {
-        cv::Mat grayscale, resized;
+        cv::Mat& grayscale = scratch.grayscale;
         
-        // Convert to grayscale if necessary
-        if (image.channels() == 3 || image.channels() == 4) {
-            cv::cvtColor(image, grayscale, cv::COLOR_BGR2GRAY);
-        } else if (image.channels() == 1) {
-            grayscale = image.clone();
-        } else {
-            throw std::runtime_error("Unsupported image format with " + 
-                                    std::to_string(image.channels()) + " channels");
-        }
+        // Convert to grayscale if necessary; 16-bit luma stays 16-bit all the way to the DCT
+        ImageProcessor::convertToGrayscale(image, grayscale);
         
         // Apply light blur to reduce noise and compression artifacts
         cv::GaussianBlur(grayscale, grayscale, cv::Size(3, 3), 0);
         
         // Resize to 32x32 and convert to float for DCT
-        cv::resize(grayscale, resized, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
-        resized.convertTo(resized, CV_32F);
-        
-        return resized;
+        cv::resize(grayscale, scratch.resized, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
+        scratch.resized.convertTo(scratch.resizedFloat, CV_32F);
     }
     catch (const cv::Exception& e) {
         throw std::runtime_error("OpenCV error during image preprocessing: " + std::string(e.what()));
@@ -180,6 +192,42 @@ int Utils::hammingDistance(const std::string& hash1, const std::string& hash2) {
     return static_cast<int>(distance * 20); // Multiplier adjusts sensitivity
 }
 
+// Packs up to 64 '0'/'1' characters into a word
+uint64_t Utils::packHash(const std::string& hash) {
+    uint64_t packed = 0;
+    const size_t len = std::min<size_t>(hash.length(), 64);
+    for (size_t i = 0; i < len; i++) {
+        if (hash[i] == '1') {
+            packed |= (1ULL << i);
+        }
+    }
+    return packed;
+}
+
+// Per-byte bit counts of each XOR are summed in a word of byte lanes; a lane gains at most 8
+// per word, so the lanes are folded into the total every 31 words, before they can overflow
+int Utils::xorPopcount(const uint64_t* a, const uint64_t* b, size_t count) {
+    const uint64_t m1 = 0x5555555555555555ULL;
+    const uint64_t m2 = 0x3333333333333333ULL;
+    const uint64_t m4 = 0x0f0f0f0f0f0f0f0fULL;
+
+    int total = 0;
+    for (size_t start = 0; start < count; start += 31) {
+        const size_t end = std::min(count, start + 31);
+        uint64_t lanes = 0;
+        for (size_t i = start; i < end; i++) {
+            uint64_t x = a[i] ^ b[i];
+            x -= (x >> 1) & m1;
+            x = (x & m2) + ((x >> 2) & m2);
+            lanes += (x + (x >> 4)) & m4;
+        }
+        // Lanes hold at most 248, so the 16-bit pairs summed by the multiply cannot carry
+        total += static_cast<int>((((lanes & 0x00ff00ff00ff00ffULL) + ((lanes >> 8) & 0x00ff00ff00ff00ffULL)) *
+                                   0x0001000100010001ULL) >> 48);
+    }
+    return total;
+}
+
 // Create a simplified hash function for faster processing
 std::string Utils::computeFastHash(const cv::Mat& image) {
     // Ensure the image is valid
@@ -194,7 +242,7 @@ std::string Utils::computeFastHash(const cv::Mat& image) {
     // Convert to grayscale if not already
     cv::Mat gray;
     if (resized.channels() > 1) {
-        cv::cvtColor(resized, gray, cv::COLOR_BGR2GRAY);
+        ImageProcessor::convertToGrayscale(resized, gray);
     } else {
         gray = resized;
     }
@@ -205,11 +253,122 @@ std::string Utils::computeFastHash(const cv::Mat& image) {
     std::string hash;
     hash.reserve(256); // 16x16 = 256 bits
     
+    const bool wide = gray.depth() == CV_16U;
     for (int i = 0; i < gray.rows; i++) {
         for (int j = 0; j < gray.cols; j++) {
-            hash += (gray.at<uchar>(i, j) > median) ? "1" : "0";
+            double value = wide ? gray.at<uint16_t>(i, j) : gray.at<uchar>(i, j);
+            hash += (value > median) ? "1" : "0";
         }
     }
     
     return hash;
 }
+
+namespace {
+
+const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+inline uint64_t xxhMergeRound(uint64_t acc, uint64_t val) {
+    acc ^= xxhRound(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// One-shot XXH64 over a byte range
+uint64_t xxHash64(const unsigned char* p, size_t len, uint64_t seed) {
+    const unsigned char* const end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        const unsigned char* const limit = end - 32;
+        do {
+            v1 = xxhRound(v1, read64(p)); p += 8;
+            v2 = xxhRound(v2, read64(p)); p += 8;
+            v3 = xxhRound(v3, read64(p)); p += 8;
+            v4 = xxhRound(v4, read64(p)); p += 8;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxhMergeRound(h, v1);
+        h = xxhMergeRound(h, v2);
+        h = xxhMergeRound(h, v3);
+        h = xxhMergeRound(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += static_cast<uint64_t>(len);
+
+    while (p + 8 <= end) {
+        h ^= xxhRound(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * XXH_PRIME64_1;
+        h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace
+
+// Checksums a tile row by row, so views into a larger image need no copy.
+// Each row is seeded with the previous row's hash; the tile shape seeds the first row.
+uint64_t Utils::computeTileChecksum(const cv::Mat& tile) {
+    if (tile.empty()) {
+        throw std::runtime_error("Empty image provided for checksum");
+    }
+
+    uint64_t h = (static_cast<uint64_t>(tile.rows) << 40) ^
+                 (static_cast<uint64_t>(tile.cols) << 16) ^
+                 static_cast<uint64_t>(tile.type());
+    const size_t rowBytes = static_cast<size_t>(tile.cols) * tile.elemSize();
+
+    // Always per row, so a view and a continuous copy of the same pixels agree
+    for (int y = 0; y < tile.rows; y++) {
+        h = xxHash64(tile.ptr<unsigned char>(y), rowBytes, h);
+    }
+    return h;
+}
@@ -1,14 +1,24 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <opencv2/opencv.hpp>
 
+// Reusable buffers for perceptual hashing so repeated calls do not reallocate per tile
+struct PerceptualHashScratch {
+    cv::Mat grayscale;
+    cv::Mat resized;
+    cv::Mat resizedFloat;
+    cv::Mat dctImage;
+};
+
 class Utils {
 public:
     // File operations
     static bool fileExists(const std::string& filePath);
+    static bool directoryExists(const std::string& path);
     static std::string readFile(const std::string& filePath);
     static void writeFile(const std::string& filePath, const std::string& content);
 
@@ -17,14 +27,40 @@ public:
     
     // Perceptual hashing
     static std::string computePerceptualHash(const cv::Mat& image);
+    static std::string computePerceptualHash(const cv::Mat& image, PerceptualHashScratch& scratch);
+    static std::string perceptualHashFromDct(const cv::Mat& dctImage);
     static int hammingDistance(const std::string& hash1, const std::string& hash2);
     
+    // Packed form of a 64-character perceptual hash (character i -> bit i) and its plain bit distance
+    static uint64_t packHash(const std::string& hash);
+
+    // Number of set bits; a single POPCNT where the target has it (e.g. -mpopcnt or -march=native)
+    static int popcount64(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(value);
+#else
+        int count = 0;
+        while (value) {
+            value &= value - 1;
+            count++;
+        }
+        return count;
+#endif
+    }
+
+    // Total set bits of a[i] ^ b[i] over `count` words. Counted with SWAR bit arithmetic
+    // instead of a per-word POPCNT, so the loop vectorises with plain SSE2 or NEON.
+    static int xorPopcount(const uint64_t* a, const uint64_t* b, size_t count);
+    
     // Fast hashing
     static std::string computeFastHash(const cv::Mat& image);
     
+    // Non-cryptographic checksum (xxHash64) of the raw pixel bytes of an image or tile view
+    static uint64_t computeTileChecksum(const cv::Mat& tile);
+    
 private:
     // Helper methods for perceptual hashing
-    static cv::Mat preprocessForHash(const cv::Mat& image);
+    static void preprocessForHash(const cv::Mat& image, PerceptualHashScratch& scratch);
 };
 
 #endif // UTILS_H
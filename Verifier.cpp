@@ -0,0 +1,92 @@
+#include "Verifier.h"
+#include "HashStore.h"
+#include "LeafHasher.h"
+#include "MerkleTree.h"
+#include "Repository.h"
+#include "Utils.h"
+#include <fstream>
+
+// Two checks, cheapest first:
+// 1. The record: a Merkle Tree rebuilt from the stored leaf hashes must give the recorded
+//    root. If it does not, comparing it with the stored per-level digests from the root
+//    down finds the leaves whose entries were damaged.
+// 2. The pixels: every tile of the decoded snapshot must have the stored checksum. Tiles
+//    that do not are re-hashed and patched into the tree to recompute the root from the
+//    pixels as they are now.
+VerificationResult Verifier::verify(int version, const std::string& recordedRoot) {
+    VerificationResult result;
+    result.version = version;
+
+    VersionHashes record;
+    if (!HashStore::load(version, record)) {
+        result.status = VerificationResult::Status::Unverifiable;
+        result.detail = "no stored hash record";
+        return result;
+    }
+
+    MerkleTree rebuilt(record.leafHashes);
+    if (rebuilt.getRootHash() != recordedRoot) {
+        result.status = VerificationResult::Status::Corrupted;
+        result.detail = "hash record does not reproduce the recorded root";
+        try {
+            MerkleTree stored(record.merkleLevels);
+            for (size_t leaf : rebuilt.differingLeaves(stored)) {
+                result.corruptTiles.push_back(record.regions[leaf]);
+            }
+        } catch (const std::exception&) {
+            result.detail += " (stored levels are unusable)";
+        }
+        return result;
+    }
+
+    std::string path = Repository::snapshotPath(version);
+    if (!std::ifstream(path).good()) {
+        result.status = VerificationResult::Status::Corrupted;
+        result.detail = "snapshot is missing";
+        return result;
+    }
+    if (Repository::isLegacySnapshot(path)) {
+        // The record was hashed from the original pixels, which a JPEG does not preserve
+        result.status = VerificationResult::Status::Unverifiable;
+        result.legacySnapshot = true;
+        result.detail = "lossy JPEG snapshot; only the hash record was checked";
+        return result;
+    }
+
+    cv::Mat image = cv::imread(path, cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+        result.status = VerificationResult::Status::Corrupted;
+        result.detail = "snapshot cannot be decoded";
+        return result;
+    }
+    result.pixelBytes = image.total() * image.elemSize();
+
+    if (image.size() != record.imageSize) {
+        result.status = VerificationResult::Status::Corrupted;
+        result.detail = "snapshot size differs from the hash record";
+        return result;
+    }
+
+    std::vector<size_t> dirtyIndices;
+    std::vector<std::string> dirtyHashes;
+    for (size_t i = 0; i < record.regions.size(); i++) {
+        cv::Mat tile = image(record.regions[i]);
+        if (Utils::computeTileChecksum(tile) != record.checksums[i]) {
+            dirtyIndices.push_back(i);
+            dirtyHashes.push_back(LeafHasher::hashTile(tile));
+            result.corruptTiles.push_back(record.regions[i]);
+        }
+    }
+
+    if (dirtyIndices.empty()) {
+        result.status = VerificationResult::Status::Verified;
+        return result;
+    }
+
+    rebuilt.updateLeaves(dirtyIndices, dirtyHashes);
+    result.status = VerificationResult::Status::Corrupted;
+    result.detail = rebuilt.getRootHash() == recordedRoot
+        ? "pixels changed in " + std::to_string(dirtyIndices.size()) + " tiles (root still matches perceptually)"
+        : "pixels changed in " + std::to_string(dirtyIndices.size()) + " tiles; root recomputed from pixels differs";
+    return result;
+}
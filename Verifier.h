@@ -0,0 +1,29 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Outcome of checking one version's snapshot and hash record against its recorded root
+struct VerificationResult {
+    enum class Status { Verified, Corrupted, Unverifiable };
+
+    int version = 0;
+    Status status = Status::Verified;
+    std::string detail;
+    std::vector<cv::Rect> corruptTiles; // Leaf regions found to be damaged
+    size_t pixelBytes = 0;              // Decoded pixel data checked
+    bool legacySnapshot = false;        // Snapshot is a JPEG written before snapshots were lossless
+};
+
+// Integrity checks for stored versions (fsck)
+class Verifier {
+public:
+    // Checks that the stored record reproduces `recordedRoot` and that the snapshot's pixels
+    // still match the record, tile by tile. Only tiles whose bytes changed are re-hashed.
+    static VerificationResult verify(int version, const std::string& recordedRoot);
+};
+
+#endif // VERIFIER_H
@@ -1,13 +1,20 @@
 #include "CLI.h"
-#include "Global.h"
+#include "AllocProfiler.h"
 #include <iostream>
 #include <csignal>
+#include <cstdlib>
 
 // Signal handler for graceful shutdown
+// Only async-signal-safe calls: a running command is asked to stop at its next checkpoint
+// and leaves the repository as it was. At the prompt, or on a second interrupt, the process
+// exits at once; every change is written to the repository as it is made, so there is
+// nothing to save.
 void signalHandler(int signal) {
-    std::cout << "\nReceived interrupt signal. Saving repository and exiting...\n";
-    saveVersionRepository();
-    exit(0);
+    // Some platforms reset the handler once it has run
+    std::signal(SIGINT, signalHandler);
+    if (!CLI::interrupt()) {
+        std::_Exit(128 + signal);
+    }
 }
 
 int main() {
@@ -17,15 +24,12 @@ int main() {
         // Set up signal handling for graceful shutdown
         std::signal(SIGINT, signalHandler);
         
-        // Load any existing version repository
-        loadVersionRepository("repository.dat");
+        // Count cv::Mat buffers too when built with VERSIONARY_ALLOC_PROFILE
+        AllocProfiler::install();
         
-        // Initialize CLI
+        // Initialize CLI; it loads the version repository when it starts
         CLI cli;
         cli.run();
-        
-        // Save repository before exiting
-        saveVersionRepository();
     } 
     catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;